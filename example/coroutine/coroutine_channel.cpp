@@ -0,0 +1,136 @@
+#include <google/protobuf/service.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <future>
+#include <iostream>
+#include <string>
+
+#include "tirpc/common/config.hpp"
+#include "tirpc/common/coroutine_channel.hpp"
+#include "tirpc/common/mutex.hpp"
+#include "tirpc/net/tcp/io_thread.hpp"
+
+// producers and consumers run on different io threads, they wait for each other without blocking io threads
+auto main(int argc, char *argv[]) -> int {
+  int threads = 4;
+  int producers = 4;
+  int consumers = 4;
+  int count = 100000;
+  int capacity = 64;
+  int slots = 2;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "t:p:c:n:q:s:")) != -1) {
+    switch (opt) {
+      case 't':
+        threads = std::stoi(optarg);
+        break;
+      case 'p':
+        producers = std::stoi(optarg);
+        break;
+      case 'c':
+        consumers = std::stoi(optarg);
+        break;
+      case 'n':
+        count = std::stoi(optarg);
+        break;
+      case 'q':
+        capacity = std::stoi(optarg);
+        break;
+      case 's':
+        slots = std::stoi(optarg);
+        break;
+      default:
+        std::cerr << "Usage: " << argv[0]
+                  << " [-t io_threads] [-p producers] [-c consumers] [-n count_per_producer] [-q channel_capacity]"
+                  << " [-s semaphore_count]" << std::endl;
+        return 1;
+    }
+  }
+
+  // task queues of io threads are created by this count
+  tirpc::Config::Lookup<int>("iothread_num")->SetValue(threads);
+  tirpc::IOThreadPool pool(threads);
+  pool.Start();
+
+  tirpc::CoroutineChannel<int64_t> channel(capacity);
+  std::atomic<int> finished_producers{0};
+
+  // consumers hold a slot while they add to the shared sum, at most slots of them at the same time
+  tirpc::CoroutineSemaphore semaphore(slots);
+  std::atomic<int> in_slots{0};
+  std::atomic<int> max_in_slots{0};
+
+  tirpc::CoroutineMutex mutex;
+  tirpc::CoroutineCondVar cond;
+  // guarded by mutex
+  int64_t sum = 0;
+  int64_t received = 0;
+  int finished_consumers = 0;
+
+  std::promise<void> done;
+
+  auto begin = std::chrono::steady_clock::now();
+
+  // it waits on condition variable until all consumers finish
+  pool.AddCoroutineToThreadByIndex(0, [&]() {
+    mutex.Lock();
+    cond.Wait(mutex, [&]() { return finished_consumers == consumers; });
+    mutex.Unlock();
+    done.set_value();
+  });
+
+  for (int i = 0; i < consumers; ++i) {
+    pool.AddCoroutineToThreadByIndex(i % threads, [&]() {
+      int64_t value = 0;
+      while (channel.Recv(&value)) {
+        semaphore.Wait();
+        int n = ++in_slots;
+        int max = max_in_slots.load();
+        while (n > max && !max_in_slots.compare_exchange_weak(max, n)) {
+        }
+        mutex.Lock();
+        sum += value;
+        ++received;
+        mutex.Unlock();
+        --in_slots;
+        semaphore.Post();
+      }
+      mutex.Lock();
+      ++finished_consumers;
+      cond.NotifyAll();
+      mutex.Unlock();
+    });
+  }
+
+  for (int i = 0; i < producers; ++i) {
+    // producers are on other threads than consumers as far as possible
+    pool.AddCoroutineToThreadByIndex((i + consumers) % threads, [&, i]() {
+      for (int j = 0; j < count; ++j) {
+        channel.Send(static_cast<int64_t>(i) * count + j);
+      }
+      if (++finished_producers == producers) {
+        channel.Close();
+      }
+    });
+  }
+
+  if (done.get_future().wait_for(std::chrono::seconds(60)) != std::future_status::ready) {
+    std::cout << "Timeout, " << received << " items received" << std::endl;
+    return 1;
+  }
+  auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - begin).count();
+
+  int64_t total = static_cast<int64_t>(producers) * count;
+  bool ok = received == total && sum == total * (total - 1) / 2 && max_in_slots <= slots;
+  std::cout << producers << " producers and " << consumers << " consumers on " << threads
+            << " io threads, channel capacity " << capacity << std::endl;
+  std::cout << "Received: " << received << " of " << total << ", sum " << (ok ? "ok" : "wrong")
+            << ", max holders of semaphore: " << max_in_slots << std::endl;
+  std::cout << "Total time: " << ms << " ms" << std::endl;
+  std::cout << "Items per second: " << static_cast<int64_t>(total * 1000.0 / std::max<int64_t>(ms, 1)) << std::endl;
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,89 @@
+#include <google/protobuf/service.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "tirpc/coroutine/coroutine.hpp"
+#include "tirpc/coroutine/coroutine_pool.hpp"
+
+// every accepted connection and async rpc call gets a coroutine and returns it when it's done,
+// each io thread owns its pool
+void RunChurn(int count, int live, int pool_size, int stack_size, int64_t *us) {
+  tirpc::CoroutinePool pool(pool_size, stack_size);
+
+  // coroutines of connections and calls which are running
+  std::vector<tirpc::Coroutine::ptr> live_cors;
+  live_cors.reserve(live);
+  for (int i = 0; i < live; ++i) {
+    live_cors.push_back(pool.GetCoroutineInstanse());
+  }
+
+  auto begin = std::chrono::steady_clock::now();
+  for (int i = 0; i < count; ++i) {
+    tirpc::Coroutine::ptr cor = pool.GetCoroutineInstanse();
+    pool.ReturnCoroutine(cor);
+  }
+  *us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - begin).count();
+
+  for (auto &cor : live_cors) {
+    pool.ReturnCoroutine(cor);
+  }
+}
+
+auto main(int argc, char *argv[]) -> int {
+  int count = 1000000;
+  int threads = 1;
+  int live = 100000;
+  int pool_size = 1000;
+  int stack_kb = 32;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "n:t:l:p:s:")) != -1) {
+    switch (opt) {
+      case 'n':
+        count = std::stoi(optarg);
+        break;
+      case 't':
+        threads = std::stoi(optarg);
+        break;
+      case 'l':
+        live = std::stoi(optarg);
+        break;
+      case 'p':
+        pool_size = std::stoi(optarg);
+        break;
+      case 's':
+        stack_kb = std::stoi(optarg);
+        break;
+      default:
+        std::cerr << "Usage: " << argv[0]
+                  << " [-n count_per_thread] [-t threads] [-l live_coroutines] [-p pool_size] [-s stack_kb]"
+                  << std::endl;
+        return 1;
+    }
+  }
+
+  std::vector<int64_t> thread_us(threads);
+  std::vector<std::thread> workers;
+  for (int i = 0; i < threads; ++i) {
+    workers.emplace_back(RunChurn, count, live, pool_size, stack_kb * 1024, &thread_us[i]);
+  }
+  for (auto &worker : workers) {
+    worker.join();
+  }
+  // setup of live coroutines isn't counted, threads churn at the same time
+  int64_t us = *std::max_element(thread_us.begin(), thread_us.end());
+
+  int64_t total = static_cast<int64_t>(count) * threads;
+  std::cout << "Acquire + release: " << total << " times by " << threads << " threads with " << live
+            << " live coroutines per thread, pool size " << pool_size << std::endl;
+  std::cout << "Total time: " << us / 1000 << " ms" << std::endl;
+  std::cout << "Coroutines per second: " << static_cast<int64_t>(total * 1000000.0 / std::max<int64_t>(us, 1))
+            << std::endl;
+  return 0;
+}
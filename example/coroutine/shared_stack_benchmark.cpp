@@ -0,0 +1,134 @@
+#include <google/protobuf/service.h>
+#include <unistd.h>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "tirpc/coroutine/coroutine.hpp"
+#include "tirpc/coroutine/coroutine_pool.hpp"
+
+static bool g_stop = false;
+
+// resident memory of this process, KB
+auto GetRssKb() -> int64_t {
+  std::ifstream in("/proc/self/status");
+  std::string line;
+  while (std::getline(in, line)) {
+    if (line.rfind("VmRSS:", 0) == 0) {
+      return std::stoll(line.substr(6));
+    }
+  }
+  return 0;
+}
+
+// an idle connection waits for read in its loop coroutine with some frames on stack
+void IdleLoop(int frame_kb) {
+  char frame[1024];
+  memset(frame, frame_kb, sizeof(frame));
+  if (frame_kb > 1) {
+    IdleLoop(frame_kb - 1);
+    return;
+  }
+  while (!g_stop) {
+    tirpc::Coroutine::Yield();
+  }
+}
+
+void RunIdleConnections(const std::string &name, int count, int switches, int frame_kb, int stack_size,
+                        int shared_stacks) {
+  g_stop = false;
+  int64_t rss_begin = GetRssKb();
+  {
+    tirpc::CoroutinePool pool(1000, stack_size, shared_stacks);
+    std::vector<tirpc::Coroutine::ptr> cors;
+    cors.reserve(count);
+    for (int i = 0; i < count; ++i) {
+      cors.push_back(pool.GetCoroutineInstanse());
+      cors.back()->SetCallBack([frame_kb]() { IdleLoop(frame_kb); });
+      tirpc::Coroutine::Resume(cors.back().get());
+    }
+    int64_t rss = GetRssKb() - rss_begin;
+
+    // events of idle connections come in random order
+    std::mt19937 rng(19999);
+    std::uniform_int_distribution<int> pick(0, count - 1);
+    auto begin = std::chrono::steady_clock::now();
+    for (int i = 0; i < switches; ++i) {
+      tirpc::Coroutine::Resume(cors[pick(rng)].get());
+    }
+    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - begin).count();
+
+    size_t saved = 0;
+    for (auto &cor : cors) {
+      saved += cor->GetSavedStackSize();
+    }
+
+    std::cout << name << ": " << count << " idle coroutines, " << frame_kb << " KB frames each" << std::endl;
+    std::cout << "Resident memory: " << rss / 1024 << " MB, " << rss * 1024 / count << " bytes per coroutine"
+              << std::endl;
+    if (shared_stacks > 0) {
+      std::cout << "Saved frames: " << saved / 1024 / 1024 << " MB" << std::endl;
+    }
+    std::cout << "Resume + yield: " << ns / std::max(switches, 1) << " ns" << std::endl;
+    std::cout << std::endl;
+
+    // let functions finish, then they can be returned
+    g_stop = true;
+    for (auto &cor : cors) {
+      tirpc::Coroutine::Resume(cor.get());
+      pool.ReturnCoroutine(cor);
+    }
+  }
+}
+
+auto main(int argc, char *argv[]) -> int {
+  int count = 100000;
+  int switches = 1000000;
+  int frame_kb = 2;
+  int stack_kb = 128;
+  int shared_stacks = 16;
+  std::string mode = "both";
+
+  int opt;
+  while ((opt = getopt(argc, argv, "n:r:f:s:k:m:")) != -1) {
+    switch (opt) {
+      case 'n':
+        count = std::stoi(optarg);
+        break;
+      case 'r':
+        switches = std::stoi(optarg);
+        break;
+      case 'f':
+        frame_kb = std::stoi(optarg);
+        break;
+      case 's':
+        stack_kb = std::stoi(optarg);
+        break;
+      case 'k':
+        shared_stacks = std::stoi(optarg);
+        break;
+      case 'm':
+        mode = optarg;
+        break;
+      default:
+        std::cerr << "Usage: " << argv[0]
+                  << " [-n idle_coroutines] [-r switches] [-f frame_kb] [-s stack_kb] [-k shared_stacks]"
+                  << " [-m dedicated|shared|both]" << std::endl;
+        return 1;
+    }
+  }
+
+  tirpc::Coroutine::GetCurrentCoroutine();
+  if (mode != "shared") {
+    RunIdleConnections("Dedicated stacks", count, switches, frame_kb, stack_kb * 1024, 0);
+  }
+  if (mode != "dedicated" && shared_stacks > 0) {
+    RunIdleConnections("Shared stacks", count, switches, frame_kb, stack_kb * 1024, shared_stacks);
+  }
+  return 0;
+}
@@ -0,0 +1,88 @@
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+#include <unistd.h>
+#include <chrono>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "tirpc/net/base/reactor.hpp"
+
+// in SubReactor mode every readiness event deletes its fd and the next hooked io adds it back,
+// so the cost of one del + add cycle is paid once per event and must not grow with registered fds
+auto RunRegisterBenchmark(tirpc::Reactor *reactor, int fd_num, int cycles) -> bool {
+  std::vector<int> fds;
+  for (int i = 0; i < fd_num; ++i) {
+    int fd = eventfd(0, EFD_NONBLOCK);
+    if (fd == -1) {
+      std::cout << "Failed to create " << fd_num << " fds, error: " << strerror(errno) << std::endl;
+      break;
+    }
+    epoll_event event{};
+    event.events = EPOLLIN;
+    event.data.fd = fd;
+    reactor->AddEvent(fd, event);
+    fds.push_back(fd);
+  }
+
+  bool succ = static_cast<int>(fds.size()) == fd_num;
+  if (succ) {
+    auto begin = std::chrono::steady_clock::now();
+    for (int i = 0; i < cycles; ++i) {
+      // spread over all fds, like events of different connections
+      int fd = fds[(static_cast<int64_t>(i) * 7919) % fd_num];
+      epoll_event event{};
+      event.events = EPOLLIN;
+      event.data.fd = fd;
+      reactor->DelEvent(fd);
+      reactor->AddEvent(fd, event);
+    }
+    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - begin).count();
+    std::cout << "Registered fds: " << fd_num << ", del + add cycle: " << std::fixed << std::setprecision(1)
+              << static_cast<double>(ns) / cycles / 1000 << " us" << std::endl;
+  }
+
+  for (int fd : fds) {
+    reactor->DelEvent(fd);
+    close(fd);
+  }
+  return succ;
+}
+
+auto main(int argc, char *argv[]) -> int {
+  std::vector<int> fd_nums = {100, 1000, 10000, 19000};
+  int cycles = 200000;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "n:c:")) != -1) {
+    switch (opt) {
+      case 'n':
+        fd_nums = {std::stoi(optarg)};
+        break;
+      case 'c':
+        cycles = std::stoi(optarg);
+        break;
+      default:
+        std::cerr << "Usage: " << argv[0] << " [-n registered_fds] [-c cycles]" << std::endl;
+        return 1;
+    }
+  }
+
+  // every registered fd is a connection, allow as many as the hard limit
+  rlimit limit{};
+  getrlimit(RLIMIT_NOFILE, &limit);
+  limit.rlim_cur = limit.rlim_max;
+  setrlimit(RLIMIT_NOFILE, &limit);
+
+  // reactor of this thread, fds are added and deleted in loop thread directly
+  tirpc::Reactor *reactor = tirpc::Reactor::GetReactor();
+  for (int fd_num : fd_nums) {
+    if (!RunRegisterBenchmark(reactor, fd_num, cycles)) {
+      return 1;
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,181 @@
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <queue>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "tirpc/common/config.hpp"
+#include "tirpc/common/mutex.hpp"
+#include "tirpc/net/base/fd_event.hpp"
+#include "tirpc/net/base/reactor.hpp"
+
+// CoroutineTaskQueue before it used WorkStealDeque: one locked std::queue per io thread, thieves scan from thread 0
+class LockedTaskQueue {
+ public:
+  explicit LockedTaskQueue(int thread_num) : tasks_(thread_num), mutexs_(thread_num) {}
+
+  void Push(int thread_idx, tirpc::FdEvent *fd) {
+    tirpc::Mutex::Locker lock(mutexs_[thread_idx]);
+    tasks_[thread_idx].push(fd);
+  }
+
+  auto PopSome(int thread_idx, int pop_cnt) -> std::vector<tirpc::FdEvent *> {
+    std::vector<tirpc::FdEvent *> vec;
+    tirpc::Mutex::Locker lock(mutexs_[thread_idx]);
+    while (!tasks_[thread_idx].empty() && static_cast<int>(vec.size()) != pop_cnt) {
+      vec.push_back(tasks_[thread_idx].front());
+      tasks_[thread_idx].pop();
+    }
+    return vec;
+  }
+
+  auto Empty(int thread_idx) -> bool {
+    tirpc::Mutex::Locker lock(mutexs_[thread_idx]);
+    return tasks_[thread_idx].empty();
+  }
+
+  auto Steal(int thread_idx, int steal_cnt) -> std::vector<tirpc::FdEvent *> {
+    std::vector<tirpc::FdEvent *> vec;
+    for (int i = 0; i < static_cast<int>(tasks_.size()) && static_cast<int>(vec.size()) < steal_cnt; ++i) {
+      if (i == thread_idx) {
+        continue;
+      }
+      tirpc::Mutex::Locker lock(mutexs_[i]);
+      while (!tasks_[i].empty() && static_cast<int>(vec.size()) < steal_cnt) {
+        vec.push_back(tasks_[i].front());
+        tasks_[i].pop();
+      }
+    }
+    return vec;
+  }
+
+ private:
+  std::vector<std::queue<tirpc::FdEvent *>> tasks_;
+  std::vector<tirpc::Mutex> mutexs_;
+};
+
+// stands for resuming the coroutine of a fd event
+static void RunTask(int work) {
+  volatile int x = 0;
+  for (int i = 0; i < work; ++i) {
+    x += i;
+  }
+}
+
+// thread 0 receives every task in bursts like a hot connection, the others only get work by stealing.
+// every thread drains its own queue first and steals 16 at most when it's empty, as Reactor::Loop does
+template <class Queue, bool kHasPop>
+void RunSkewedBenchmark(const std::string &name, Queue *queue, int threads, int count, int burst, int work) {
+  std::vector<std::unique_ptr<tirpc::FdEvent>> events;
+  for (int i = 0; i < burst; ++i) {
+    events.push_back(std::make_unique<tirpc::FdEvent>(i));
+  }
+  std::atomic<int> done{0};
+  std::atomic<bool> stop{false};
+  std::vector<int> executed(threads, 0);
+
+  auto begin = std::chrono::steady_clock::now();
+  std::vector<std::thread> workers;
+  for (int idx = 0; idx < threads; ++idx) {
+    workers.emplace_back([&, idx]() {
+      int produced = 0;
+      auto execute = [&]() {
+        RunTask(work);
+        ++executed[idx];
+        if (done.fetch_add(1) + 1 == count) {
+          stop = true;
+        }
+      };
+      while (!stop.load(std::memory_order_relaxed)) {
+        if (idx == 0 && produced < count) {
+          for (int i = 0; i < burst && produced < count; ++i, ++produced) {
+            queue->Push(0, events[i].get());
+          }
+        }
+        if (queue->Empty(idx)) {
+          for (auto *task : queue->Steal(idx, 16)) {
+            if (task != nullptr) {
+              execute();
+            }
+          }
+          if (idx != 0) {
+            std::this_thread::yield();
+          }
+          continue;
+        }
+        if constexpr (kHasPop) {
+          while (queue->Pop(idx) != nullptr) {
+            execute();
+          }
+        } else {
+          std::vector<tirpc::FdEvent *> tasks;
+          while (!(tasks = queue->PopSome(idx, 16)).empty()) {
+            for (size_t i = 0; i < tasks.size(); ++i) {
+              execute();
+            }
+          }
+        }
+      }
+    });
+  }
+  for (auto &worker : workers) {
+    worker.join();
+  }
+  auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - begin).count();
+
+  std::cout << name << ": " << count << " tasks on " << threads << " threads, " << ms << " ms, share of threads:";
+  for (int n : executed) {
+    std::cout << " " << n * 100 / std::max(count, 1) << "%";
+  }
+  std::cout << std::endl;
+}
+
+auto main(int argc, char *argv[]) -> int {
+  int threads = 4;
+  int count = 400000;
+  int burst = 4096;
+  int work = 3000;
+  int rounds = 2;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "t:n:b:w:r:")) != -1) {
+    switch (opt) {
+      case 't':
+        threads = std::stoi(optarg);
+        break;
+      case 'n':
+        count = std::stoi(optarg);
+        break;
+      case 'b':
+        burst = std::stoi(optarg);
+        break;
+      case 'w':
+        work = std::stoi(optarg);
+        break;
+      case 'r':
+        rounds = std::stoi(optarg);
+        break;
+      default:
+        std::cerr << "Usage: " << argv[0] << " [-t threads] [-n tasks] [-b burst] [-w work_per_task] [-r rounds]"
+                  << std::endl;
+        return 1;
+    }
+  }
+
+  // CoroutineTaskQueue has one deque for every io thread
+  tirpc::Config::Lookup<int>("iothread_num")->SetValue(threads);
+  tirpc::CoroutineTaskQueue *steal_queue = tirpc::CoroutineTaskQueue::GetCoroutineTaskQueue();
+
+  for (int r = 0; r < rounds; ++r) {
+    LockedTaskQueue locked_queue(threads);
+    RunSkewedBenchmark<LockedTaskQueue, false>("locked queue", &locked_queue, threads, count, burst, work);
+    RunSkewedBenchmark<tirpc::CoroutineTaskQueue, true>("chase-lev   ", steal_queue, threads, count, burst, work);
+  }
+  return 0;
+}
@@ -1,13 +1,16 @@
 #include <google/protobuf/service.h>
+#include <sys/socket.h>
 #include <unistd.h>
 #include <atomic>
 #include <chrono>
+#include <cstring>
 #include <iostream>
 #include <memory>
 #include <thread>
 #include <vector>
 
 #include "rpc_server.pb.h"
+#include "tirpc/common/config.hpp"
 #include "tirpc/common/const.hpp"
 #include "tirpc/common/start.hpp"
 #include "tirpc/net/base/address.hpp"
@@ -62,13 +65,53 @@ void RunBenchmark(int numClients, int duration, const std::vector<tirpc::Address
   std::cout << std::endl;
 }
 
+// connect, half close, and wait for server closes it, so every connection is accepted and served by server
+void AcceptWorkerFunction(const tirpc::Address::ptr &addr, std::atomic<int> &success_count, int duration) {
+  auto end_time = std::chrono::high_resolution_clock::now() + std::chrono::seconds(duration);
+  char buf[16];
+  while (std::chrono::high_resolution_clock::now() < end_time) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+      std::cerr << "socket error: " << strerror(errno) << std::endl;
+      return;
+    }
+    if (connect(fd, addr->GetSockAddr(), addr->GetSockLen()) == 0) {
+      shutdown(fd, SHUT_WR);
+      if (recv(fd, buf, sizeof(buf), 0) == 0) {
+        success_count.fetch_add(1, std::memory_order_relaxed);
+      }
+    }
+    close(fd);
+  }
+}
+
+void RunAcceptBenchmark(int numClients, int duration, const tirpc::Address::ptr &addr) {
+  std::atomic<int> success_count(0);
+  std::vector<std::thread> benchmark_threads;
+  for (int i = 0; i < numClients; ++i) {
+    benchmark_threads.emplace_back(AcceptWorkerFunction, addr, std::ref(success_count), duration);
+  }
+  for (auto &thread : benchmark_threads) {
+    thread.join();
+  }
+
+  double aps = static_cast<double>(success_count) / static_cast<double>(duration);
+  std::cout << "Total clients: " << numClients << ", Total time: " << duration << " s" << std::endl;
+  std::cout << "Accepted connections: " << success_count << std::endl;
+  std::cout << "Accepts per second: " << aps << std::endl;
+
+  std::cout << std::endl;
+}
+
 auto main(int argc, char *argv[]) -> int {
   // default config file
   int num_clients = 1;
   int duration = 10;
+  bool conn_pool = true;
+  bool accept_only = false;
 
   int opt;
-  while ((opt = getopt(argc, argv, "c:t:")) != -1) {
+  while ((opt = getopt(argc, argv, "c:t:sa")) != -1) {
     switch (opt) {
       case 'c':
         num_clients = std::stoi(optarg);
@@ -76,8 +119,16 @@ auto main(int argc, char *argv[]) -> int {
       case 't':
         duration = std::stoi(optarg);
         break;
+      case 's':
+        // short connection: every call creates a new TcpClient, compare with pooled connection
+        conn_pool = false;
+        break;
+      case 'a':
+        // accept storm: only connect and disconnect, measure accepts per second of server
+        accept_only = true;
+        break;
       default:
-        std::cerr << "Usage: " << argv[0] << " [-c num_clients] [-t duration]" << std::endl;
+        std::cerr << "Usage: " << argv[0] << " [-c num_clients] [-t duration] [-s] [-a]" << std::endl;
         return 1;
     }
   }
@@ -87,6 +138,16 @@ auto main(int argc, char *argv[]) -> int {
 
   std::vector<tirpc::Address::ptr> addrs = {std::make_shared<tirpc::IPAddress>("127.0.0.1", 39999)};
 
+  if (accept_only) {
+    std::cout << "Connection: accept only" << std::endl;
+    RunAcceptBenchmark(num_clients, duration, addrs.front());
+    return 0;
+  }
+
+  std::cout << "Connection: " << (conn_pool ? "pooled" : "short") << std::endl;
+
+  tirpc::Config::Lookup<bool>("client.conn_pool")->SetValue(conn_pool);
+
   RunBenchmark(num_clients, duration, addrs);
 
   return 0;
@@ -1,4 +1,5 @@
 #include <google/protobuf/service.h>
+#include <cstring>
 #include <memory>
 
 #include "rpc_server.pb.h"
@@ -163,11 +164,22 @@ auto main(int argc, char *argv[]) -> int {
   // default config file
   std::string config_file = "./conf/http_server.yml";
 
-  if (argc == 2) {
-    config_file = argv[1];
+  // --use-locked-queue / --use-lock-free-queue override use_lock_free of config file, see tools/auto_benchmark.sh
+  int use_lock_free = -1;
+  for (int i = 1; i < argc; ++i) {
+    if (std::strcmp(argv[i], "--use-locked-queue") == 0) {
+      use_lock_free = 0;
+    } else if (std::strcmp(argv[i], "--use-lock-free-queue") == 0) {
+      use_lock_free = 1;
+    } else {
+      config_file = argv[i];
+    }
   }
 
   tirpc::Config::LoadFromFile(config_file);
+  if (use_lock_free != -1) {
+    tirpc::Config::Lookup("use_lock_free", false)->SetValue(use_lock_free == 1);
+  }
 
   auto server = std::make_shared<tirpc::HttpServer>();
 
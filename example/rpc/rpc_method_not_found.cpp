@@ -0,0 +1,125 @@
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <string>
+
+#include "tirpc/common/error_code.hpp"
+#include "tirpc/net/rpc/rpc_codec.hpp"
+#include "tirpc/net/rpc/rpc_data.hpp"
+#include "tirpc/net/tcp/tcp_buffer.hpp"
+
+// requests for methods server doesn't have must get an error reply instead of timeout, both TinyPb v1 and v2,
+// also after a broken header
+auto main(int argc, char *argv[]) -> int {
+  std::string ip = "127.0.0.1";
+  int port = 39999;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "i:p:")) != -1) {
+    switch (opt) {
+      case 'i':
+        ip = optarg;
+        break;
+      case 'p':
+        port = std::stoi(optarg);
+        break;
+      default:
+        std::cerr << "Usage: " << argv[0] << " [-i ip] [-p port]" << std::endl;
+        return 1;
+    }
+  }
+
+  tirpc::TinyPbCodeC codec;
+  tirpc::TcpBuffer out(1024);
+  // msg_seq of reply -> expected err_code
+  std::map<std::string, int> expected;
+
+  // broken header with pk_len over tinypb.max_pk_len, server must skip it rather than wait for the data
+  const char broken[] = {0x02, 0x7f, 0x7f, 0x7f, 0x7f};
+  out.WriteToBuffer(broken, sizeof(broken));
+
+  // v2 request with a method id server never assigned
+  tirpc::TinyPbStruct unknown_id;
+  unknown_id.version_ = tirpc::TinyPb_V2;
+  unknown_id.msg_id_ = 1;
+  unknown_id.method_id_ = 9999;
+  codec.Encode(&out, &unknown_id);
+  expected["1"] = tirpc::ERROR_METHOD_NOT_FOUND;
+
+  // v2 request with method id 0, codec refuses to encode it, so patch method_id of a valid one
+  tirpc::TinyPbStruct zero_id;
+  zero_id.version_ = tirpc::TinyPb_V2;
+  zero_id.msg_id_ = 2;
+  zero_id.method_id_ = 1;
+  int begin = out.WriteIndex();
+  codec.Encode(&out, &zero_id);
+  memset(&out.buffer_[begin + sizeof(char) + sizeof(int32_t) + sizeof(uint64_t)], 0, sizeof(uint32_t));
+  expected["2"] = tirpc::ERROR_METHOD_NOT_FOUND;
+
+  // v1 request with a method name server doesn't have
+  tirpc::TinyPbStruct unknown_name;
+  unknown_name.msg_seq_ = "v1_unknown_method";
+  unknown_name.service_full_name_ = "QueryService.no_such_method";
+  codec.Encode(&out, &unknown_name);
+  expected[unknown_name.msg_seq_] = tirpc::ERROR_METHOD_NOT_FOUND;
+
+  if (!unknown_id.encode_succ_ || !zero_id.encode_succ_ || !unknown_name.encode_succ_) {
+    std::cout << "Failed to encode requests" << std::endl;
+    return 1;
+  }
+
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  inet_pton(AF_INET, ip.c_str(), &addr.sin_addr);
+  if (connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0) {
+    std::cout << "Failed to connect [" << ip << ":" << port << "], error: " << strerror(errno) << std::endl;
+    return 1;
+  }
+  // a lost reply shows up as timeout of recv
+  timeval timeout{3, 0};
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+  if (send(fd, out.buffer_.data() + out.ReadIndex(), out.Readable(), 0) != out.Readable()) {
+    std::cout << "Failed to send requests, error: " << strerror(errno) << std::endl;
+    return 1;
+  }
+
+  tirpc::TcpBuffer in(1024);
+  int replied = 0;
+  int wrong = 0;
+  while (replied < static_cast<int>(expected.size())) {
+    char *dst = in.ReserveWrite(1024);
+    ssize_t n = recv(fd, dst, 1024, 0);
+    if (n <= 0) {
+      std::cout << "Failed to recv reply, error: " << (n == 0 ? "peer closed" : strerror(errno)) << std::endl;
+      break;
+    }
+    in.RecycleWrite(n);
+
+    while (in.Readable() > 0) {
+      tirpc::TinyPbStruct reply;
+      codec.Decode(&in, &reply);
+      if (!reply.decode_succ_) {
+        break;
+      }
+      ++replied;
+      auto it = expected.find(reply.msg_seq_);
+      bool ok = it != expected.end() && reply.err_code_ == it->second;
+      wrong += ok ? 0 : 1;
+      std::cout << "Reply " << reply.msg_seq_ << ", version: " << reply.version_ << ", err_code: " << reply.err_code_
+                << ", err_info: " << reply.err_info_ << (ok ? "" : " [wrong]") << std::endl;
+    }
+    in.AdjustBuffer();
+  }
+  close(fd);
+
+  std::cout << "Replies: " << replied << " of " << expected.size() << ", wrong: " << wrong << std::endl;
+  return replied == static_cast<int>(expected.size()) && wrong == 0 ? 0 : 1;
+}
@@ -0,0 +1,282 @@
+#include <arpa/inet.h>
+#include <google/protobuf/service.h>
+#include <google/protobuf/unknown_field_set.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "rpc_server.pb.h"
+#include "tirpc/common/config.hpp"
+#include "tirpc/common/error_code.hpp"
+#include "tirpc/coroutine/coroutine.hpp"
+#include "tirpc/coroutine/coroutine_pool.hpp"
+#include "tirpc/net/base/address.hpp"
+#include "tirpc/net/base/reactor.hpp"
+#include "tirpc/net/base/timer.hpp"
+#include "tirpc/net/rpc/rpc_channel.hpp"
+#include "tirpc/net/rpc/rpc_codec.hpp"
+#include "tirpc/net/rpc/rpc_controller.hpp"
+#include "tirpc/net/rpc/rpc_data.hpp"
+#include "tirpc/net/tcp/tcp_buffer.hpp"
+
+// serves one connection, replies query_age after delay_ms and query_name at once, it stops after both are replied
+static void ServeSlowAndFast(int listen_fd, int delay_ms) {
+  int fd = accept(listen_fd, nullptr, nullptr);
+  if (fd < 0) {
+    return;
+  }
+  tirpc::TinyPbCodeC codec;
+  tirpc::TcpBuffer in(1024);
+  tirpc::TcpBuffer out(1024);
+  std::vector<std::pair<std::chrono::steady_clock::time_point, tirpc::TinyPbStruct>> delayed;
+  int replied = 0;
+
+  while (replied < 2) {
+    auto now = std::chrono::steady_clock::now();
+    int wait_ms = -1;
+    for (auto it = delayed.begin(); it != delayed.end();) {
+      if (it->first <= now) {
+        codec.Encode(&out, &it->second);
+        ++replied;
+        it = delayed.erase(it);
+        continue;
+      }
+      wait_ms = std::chrono::duration_cast<std::chrono::milliseconds>(it->first - now).count() + 1;
+      ++it;
+    }
+    while (out.Readable() > 0) {
+      ssize_t n = send(fd, out.buffer_.data() + out.ReadIndex(), out.Readable(), 0);
+      if (n <= 0) {
+        close(fd);
+        return;
+      }
+      out.RecycleRead(n);
+    }
+    if (replied == 2) {
+      break;
+    }
+
+    pollfd pfd = {fd, POLLIN, 0};
+    if (poll(&pfd, 1, wait_ms) <= 0) {
+      continue;
+    }
+    char *dst = in.ReserveWrite(4096);
+    ssize_t n = recv(fd, dst, 4096, 0);
+    if (n <= 0) {
+      break;
+    }
+    in.RecycleWrite(n);
+
+    while (in.Readable() > 0) {
+      tirpc::TinyPbStruct req;
+      codec.Decode(&in, &req);
+      if (!req.decode_succ_) {
+        break;
+      }
+      tirpc::TinyPbStruct reply;
+      reply.msg_seq_ = req.msg_seq_;
+      reply.service_full_name_ = req.service_full_name_;
+      if (req.service_full_name_ == "QueryService.query_age") {
+        queryAgeReq age_req;
+        queryAgeRes age_res;
+        req.ParsePbData(&age_req);
+        age_res.set_id(age_req.id());
+        age_res.SerializeToString(&reply.pb_data_);
+        delayed.emplace_back(std::chrono::steady_clock::now() + std::chrono::milliseconds(delay_ms), reply);
+        continue;
+      }
+      if (req.service_full_name_ == "QueryService.query_name") {
+        queryNameReq name_req;
+        queryNameRes name_res;
+        req.ParsePbData(&name_req);
+        name_res.set_id(name_req.id());
+        name_res.SerializeToString(&reply.pb_data_);
+        ++replied;
+      } else {
+        // TinyPb v2 negotiate request, client keeps using v1
+        reply.err_code_ = tirpc::ERROR_METHOD_NOT_FOUND;
+        reply.err_info_ = "not found method " + req.service_full_name_;
+      }
+      codec.Encode(&out, &reply);
+    }
+    in.AdjustBuffer();
+  }
+  close(fd);
+}
+
+// a fast call must not wait for reply of a slow call which is in flight on the same connection
+static auto RunSlowAndFast(int delay_ms) -> int {
+  int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+  sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  inet_pton(AF_INET, "127.0.0.1", &addr.sin_addr);
+  socklen_t len = sizeof(addr);
+  if (bind(listen_fd, reinterpret_cast<sockaddr *>(&addr), len) != 0 || listen(listen_fd, 1) != 0 ||
+      getsockname(listen_fd, reinterpret_cast<sockaddr *>(&addr), &len) != 0) {
+    std::cout << "Failed to listen, error: " << strerror(errno) << std::endl;
+    return 1;
+  }
+  std::thread server(ServeSlowAndFast, listen_fd, delay_ms);
+
+  tirpc::Config::Lookup<bool>("client.conn_pool")->SetValue(true);
+
+  tirpc::Reactor *reactor = tirpc::Reactor::GetReactor();
+  reactor->SetReactorType(tirpc::MainReactor);
+
+  tirpc::Address::ptr peer = std::make_shared<tirpc::IPAddress>("127.0.0.1", ntohs(addr.sin_port));
+  int slow_rt = -1;
+  int fast_rt = -1;
+  int64_t slow_ms = 0;
+  int64_t fast_ms = 0;
+  int finished = 0;
+
+  auto call = [&](bool slow) {
+    auto begin = std::chrono::steady_clock::now();
+    tirpc::RpcChannel channel(peer);
+    QueryService_Stub stub(&channel);
+    tirpc::RpcController rpc_controller;
+    // fast call times out long before reply of slow call arrives
+    rpc_controller.SetTimeout(slow ? delay_ms * 3 : delay_ms / 3);
+    int rt = 0;
+    if (slow) {
+      queryAgeReq rpc_req;
+      queryAgeRes rpc_res;
+      rpc_req.set_id(1);
+      stub.query_age(&rpc_controller, &rpc_req, &rpc_res, nullptr);
+      rt = rpc_controller.ErrorCode() != 0 ? rpc_controller.ErrorCode() : (rpc_res.id() == 1 ? 0 : -1);
+    } else {
+      queryNameReq rpc_req;
+      queryNameRes rpc_res;
+      rpc_req.set_id(2);
+      stub.query_name(&rpc_controller, &rpc_req, &rpc_res, nullptr);
+      rt = rpc_controller.ErrorCode() != 0 ? rpc_controller.ErrorCode() : (rpc_res.id() == 2 ? 0 : -1);
+    }
+    auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - begin).count();
+    (slow ? slow_rt : fast_rt) = rt;
+    (slow ? slow_ms : fast_ms) = ms;
+    if (++finished == 2) {
+      reactor->Stop();
+    }
+  };
+
+  tirpc::Coroutine::ptr slow_cor = tirpc::GetCoroutinePool()->GetCoroutineInstanse();
+  slow_cor->SetCallBack([&]() { call(true); });
+  tirpc::Coroutine::ptr fast_cor = tirpc::GetCoroutinePool()->GetCoroutineInstanse();
+  fast_cor->SetCallBack([&]() { call(false); });
+
+  reactor->AddCoroutine(slow_cor);
+  // start fast call after slow call has been sent and its coroutine waits for reply
+  reactor->GetTimer()->AddTimerEvent(
+      std::make_shared<tirpc::TimerEvent>(delay_ms / 10, false, [&]() { reactor->AddCoroutine(fast_cor); }));
+  reactor->Loop();
+
+  server.join();
+  close(listen_fd);
+
+  std::cout << "Slow call: error code " << slow_rt << ", " << slow_ms << " ms" << std::endl;
+  std::cout << "Fast call: error code " << fast_rt << ", " << fast_ms << " ms" << std::endl;
+  return slow_rt == 0 && fast_rt == 0 && fast_ms < delay_ms ? 0 : 1;
+}
+
+// coroutines of one thread share one pooled connection, requests larger than socket buffer make the coroutine which
+// owns io wait for writable while others append their requests, every reply must still match its request
+auto main(int argc, char *argv[]) -> int {
+  int coroutines = 8;
+  int calls = 50;
+  int payload_kb = 4096;
+  int timeout = 10000;
+  int delay_ms = 0;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "c:n:p:t:s:")) != -1) {
+    switch (opt) {
+      case 'c':
+        coroutines = std::stoi(optarg);
+        break;
+      case 'n':
+        calls = std::stoi(optarg);
+        break;
+      case 'p':
+        payload_kb = std::stoi(optarg);
+        break;
+      case 't':
+        timeout = std::stoi(optarg);
+        break;
+      case 's':
+        delay_ms = std::stoi(optarg);
+        break;
+      default:
+        std::cerr << "Usage: " << argv[0] << " [-c coroutines] [-n calls_per_coroutine] [-p payload_kb] [-t timeout_ms]"
+                  << " [-s slow_call_delay_ms]" << std::endl;
+        return 1;
+    }
+  }
+
+  if (delay_ms > 0) {
+    return RunSlowAndFast(delay_ms);
+  }
+
+  tirpc::Config::Lookup<bool>("client.conn_pool")->SetValue(true);
+
+  tirpc::Reactor *reactor = tirpc::Reactor::GetReactor();
+  reactor->SetReactorType(tirpc::MainReactor);
+
+  tirpc::Address::ptr addr = std::make_shared<tirpc::IPAddress>("127.0.0.1", 39999);
+  int succ = 0;
+  int mismatch = 0;
+  int failed = 0;
+  int finished = 0;
+
+  auto begin = std::chrono::steady_clock::now();
+  for (int c = 0; c < coroutines; ++c) {
+    tirpc::Coroutine::ptr cor = tirpc::GetCoroutinePool()->GetCoroutineInstanse();
+    cor->SetCallBack([&, c]() {
+      tirpc::RpcChannel channel(addr);
+      QueryService_Stub stub(&channel);
+      for (int i = 0; i < calls; ++i) {
+        tirpc::RpcController rpc_controller;
+        rpc_controller.SetTimeout(timeout);
+
+        queryNameReq rpc_req;
+        queryNameRes rpc_res;
+        rpc_req.set_id(c * calls + i);
+        // server skips unknown field, it only makes the request big, a corrupted stream fails to decode
+        std::string payload(payload_kb * 1024, static_cast<char>('a' + (c + i) % 26));
+        rpc_req.GetReflection()->MutableUnknownFields(&rpc_req)->AddLengthDelimited(100, payload);
+
+        stub.query_name(&rpc_controller, &rpc_req, &rpc_res, nullptr);
+        if (rpc_controller.ErrorCode() != 0) {
+          if (++failed <= 5) {
+            std::cout << "Call failed, error code: " << rpc_controller.ErrorCode()
+                      << ", error info: " << rpc_controller.ErrorText() << std::endl;
+          }
+        } else if (rpc_res.id() != rpc_req.id()) {
+          ++mismatch;
+        } else {
+          ++succ;
+        }
+      }
+      if (++finished == coroutines) {
+        reactor->Stop();
+      }
+    });
+    reactor->AddCoroutine(cor);
+  }
+  reactor->Loop();
+  auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - begin).count();
+
+  int total = coroutines * calls;
+  std::cout << coroutines << " coroutines on one connection, " << payload_kb << " KB per request" << std::endl;
+  std::cout << "Successful calls: " << succ << " of " << total << ", mismatched replies: " << mismatch
+            << ", failed calls: " << failed << std::endl;
+  std::cout << "Total time: " << ms << " ms" << std::endl;
+  return succ == total ? 0 : 1;
+}
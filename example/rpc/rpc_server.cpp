@@ -1,6 +1,8 @@
 #include <google/protobuf/service.h>
+#include <cstring>
 #include <memory>
 #include <string>
+#include <vector>
 
 #include "rpc_server.pb.h"
 
@@ -67,17 +69,34 @@ auto main(int argc, char *argv[]) -> int {
   std::string config_file = "./conf/rpc_server.yml";
   int port = -1;
 
-  if (argc == 2) {
-    config_file = argv[1];
-  } else if (argc == 4) {
-    if (std::strcmp(argv[2], "-p") != 0) {
-      std::cout << "usage: " << argv[0] << " <config> -p <port>" << std::endl;
+  // --use-locked-queue / --use-lock-free-queue override use_lock_free of config file, see tools/rpc_benchmark.sh
+  int use_lock_free = -1;
+  std::vector<char *> args;
+  for (int j = 0; j < argc; ++j) {
+    if (std::strcmp(argv[j], "--use-locked-queue") == 0) {
+      use_lock_free = 0;
+    } else if (std::strcmp(argv[j], "--use-lock-free-queue") == 0) {
+      use_lock_free = 1;
+    } else {
+      args.push_back(argv[j]);
     }
-    config_file = argv[1];
-    port = std::stoi(argv[3]);
+  }
+
+  if (args.size() == 2) {
+    config_file = args[1];
+  } else if (args.size() == 4) {
+    if (std::strcmp(args[2], "-p") != 0) {
+      std::cout << "usage: " << args[0] << " <config> -p <port> [--use-locked-queue|--use-lock-free-queue]"
+                << std::endl;
+    }
+    config_file = args[1];
+    port = std::stoi(args[3]);
   }
 
   tirpc::Config::LoadFromFile(config_file);
+  if (use_lock_free != -1) {
+    tirpc::Config::Lookup("use_lock_free", false)->SetValue(use_lock_free == 1);
+  }
 
   auto server = std::make_shared<tirpc::RpcServer>();
 
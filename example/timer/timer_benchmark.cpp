@@ -0,0 +1,116 @@
+#include <google/protobuf/service.h>
+#include <unistd.h>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "tirpc/net/base/reactor.hpp"
+#include "tirpc/net/base/timer.hpp"
+
+// timeout of rpc calls and connects, ms
+static std::mt19937 g_rng(19999);
+static std::uniform_int_distribution<int> g_timeout(1, 10000);
+
+// every rpc call and connect adds a timer and deletes it when it returns before timeout
+void RunChurnBenchmark(tirpc::Timer *timer, int count, int live) {
+  // timers of other calls which are waiting
+  std::vector<tirpc::TimerEvent::ptr> live_events;
+  for (int i = 0; i < live; ++i) {
+    live_events.push_back(std::make_shared<tirpc::TimerEvent>(g_timeout(g_rng), false, []() {}));
+    timer->AddTimerEvent(live_events.back());
+  }
+
+  auto begin = std::chrono::steady_clock::now();
+  for (int i = 0; i < count; ++i) {
+    auto event = std::make_shared<tirpc::TimerEvent>(g_timeout(g_rng), false, []() {});
+    timer->AddTimerEvent(event);
+    timer->DelTimerEvent(event);
+  }
+  auto us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - begin).count();
+
+  for (auto &event : live_events) {
+    timer->DelTimerEvent(event);
+  }
+
+  std::cout << "Churn: " << count << " add + del with " << live << " live timers" << std::endl;
+  std::cout << "Total time: " << us / 1000 << " ms" << std::endl;
+  std::cout << "Timers per second: " << static_cast<int64_t>(count * 1000000.0 / std::max<int64_t>(us, 1)) << std::endl;
+  std::cout << std::endl;
+}
+
+// timers expire in loop, check how late they are
+void RunFireBenchmark(tirpc::Reactor *reactor, tirpc::Timer *timer, int count) {
+  std::uniform_int_distribution<int> timeout(1, 1000);
+  int fired = 0;
+  int64_t max_late = 0;
+  int64_t total_late = 0;
+  int64_t loop_start = 0;
+  std::vector<tirpc::TimerEvent::ptr> events;
+  events.reserve(count);
+  for (int i = 0; i < count; ++i) {
+    auto event = std::make_shared<tirpc::TimerEvent>(timeout(g_rng), false, nullptr);
+    tirpc::TimerEvent *ptr = event.get();
+    event->task_ = [&, ptr]() {
+      // timers which arrive while they are being added can't fire before loop starts
+      int64_t late = tirpc::GetNowMs() - std::max(ptr->arrive_time_, loop_start);
+      max_late = std::max(max_late, late);
+      total_late += late;
+      if (++fired == count) {
+        reactor->Stop();
+      }
+    };
+    timer->AddTimerEvent(event);
+    events.push_back(std::move(event));
+  }
+
+  auto begin = std::chrono::steady_clock::now();
+  loop_start = tirpc::GetNowMs();
+  reactor->Loop();
+  auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - begin).count();
+
+  std::cout << "Fire: " << fired << " timers in 1 ~ 1000 ms" << std::endl;
+  std::cout << "Total time: " << ms << " ms" << std::endl;
+  std::cout << "Max late: " << max_late << " ms, average late: " << static_cast<double>(total_late) / count << " ms"
+            << std::endl;
+  std::cout << std::endl;
+}
+
+auto main(int argc, char *argv[]) -> int {
+  int count = 1000000;
+  int live = 100000;
+  int fire_count = 100000;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "n:l:f:")) != -1) {
+    switch (opt) {
+      case 'n':
+        count = std::stoi(optarg);
+        break;
+      case 'l':
+        live = std::stoi(optarg);
+        break;
+      case 'f':
+        fire_count = std::stoi(optarg);
+        break;
+      default:
+        std::cerr << "Usage: " << argv[0] << " [-n churn_count] [-l live_timers] [-f fire_count]" << std::endl;
+        return 1;
+    }
+  }
+
+  tirpc::Reactor *reactor = tirpc::Reactor::GetReactor();
+  // main reactor doesn't touch io threads' coroutine queues
+  reactor->SetReactorType(tirpc::MainReactor);
+  tirpc::Timer *timer = reactor->GetTimer();
+
+  RunChurnBenchmark(timer, count, live);
+  if (fire_count > 0) {
+    RunFireBenchmark(reactor, timer, fire_count);
+  }
+
+  return 0;
+}
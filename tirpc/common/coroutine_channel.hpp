@@ -0,0 +1,176 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <queue>
+#include <utility>
+
+#include "tirpc/common/log.hpp"
+#include "tirpc/common/mutex.hpp"
+#include "tirpc/coroutine/coroutine.hpp"
+
+namespace tirpc {
+
+/**
+ * @brief 有界的多生产者多消费者通道，满时 Send 挂起发送的协程，空时 Recv 挂起接收的协程
+ * 协程可以在不同的 IO 线程上，被挂起的协程由它所在线程的 Reactor 恢复。
+ * 不在协程中时只能调用 TrySend、TryRecv 和 Close
+ */
+template <class T>
+class CoroutineChannel {
+ public:
+  explicit CoroutineChannel(size_t capacity = 1) : capacity_(std::max<size_t>(capacity, 1)) {}
+
+  CoroutineChannel(const CoroutineChannel &) = delete;
+  auto operator=(const CoroutineChannel &) -> CoroutineChannel & = delete;
+
+  /**
+   * @brief 发送 value，通道满时挂起当前协程直到有空位
+   *
+   * @return 通道已经关闭时返回 false
+   */
+  auto Send(T value) -> bool {
+    Mutex::Locker lock(mutex_);
+    while (!is_closed_ && items_.size() >= capacity_) {
+      if (Coroutine::IsMainCoroutine()) {
+        LOG_ERROR << "main coroutine can't wait on coroutine channel";
+        return false;
+      }
+      auto waiter = std::make_shared<CoroutineWaiter>();
+      send_waiters_.push(waiter);
+      lock.Unlock();
+      waiter->Wait();
+      lock.Lock();
+    }
+    if (is_closed_) {
+      return false;
+    }
+    items_.push(std::move(value));
+    CoroutineWaiter::ptr receiver = PopWaiter(recv_waiters_);
+    lock.Unlock();
+
+    if (receiver != nullptr) {
+      receiver->Wake();
+    }
+    return true;
+  }
+
+  /**
+   * @brief 通道没满并且没关闭时发送 value，不会挂起
+   */
+  auto TrySend(T value) -> bool {
+    Mutex::Locker lock(mutex_);
+    if (is_closed_ || items_.size() >= capacity_) {
+      return false;
+    }
+    items_.push(std::move(value));
+    CoroutineWaiter::ptr receiver = PopWaiter(recv_waiters_);
+    lock.Unlock();
+
+    if (receiver != nullptr) {
+      receiver->Wake();
+    }
+    return true;
+  }
+
+  /**
+   * @brief 接收一个值放入 value，通道空时挂起当前协程直到有值
+   *
+   * @return 通道已经关闭并且取完时返回 false
+   */
+  auto Recv(T *value) -> bool {
+    Mutex::Locker lock(mutex_);
+    while (!is_closed_ && items_.empty()) {
+      if (Coroutine::IsMainCoroutine()) {
+        LOG_ERROR << "main coroutine can't wait on coroutine channel";
+        return false;
+      }
+      auto waiter = std::make_shared<CoroutineWaiter>();
+      recv_waiters_.push(waiter);
+      lock.Unlock();
+      waiter->Wait();
+      lock.Lock();
+    }
+    return TakeItem(value, lock);
+  }
+
+  /**
+   * @brief 通道不空时接收一个值放入 value，不会挂起
+   */
+  auto TryRecv(T *value) -> bool {
+    Mutex::Locker lock(mutex_);
+    return TakeItem(value, lock);
+  }
+
+  /**
+   * @brief 关闭通道，唤醒所有等待的协程。之后 Send 都返回 false，Recv 取完剩下的值后返回 false
+   */
+  void Close() {
+    std::queue<CoroutineWaiter::ptr> senders;
+    std::queue<CoroutineWaiter::ptr> receivers;
+    Mutex::Locker lock(mutex_);
+    is_closed_ = true;
+    senders.swap(send_waiters_);
+    receivers.swap(recv_waiters_);
+    lock.Unlock();
+
+    while (CoroutineWaiter::ptr waiter = PopWaiter(senders)) {
+      waiter->Wake();
+    }
+    while (CoroutineWaiter::ptr waiter = PopWaiter(receivers)) {
+      waiter->Wake();
+    }
+  }
+
+  auto Size() -> size_t {
+    Mutex::Locker lock(mutex_);
+    return items_.size();
+  }
+
+  auto IsClosed() -> bool {
+    Mutex::Locker lock(mutex_);
+    return is_closed_;
+  }
+
+ private:
+  static auto PopWaiter(std::queue<CoroutineWaiter::ptr> &waiters) -> CoroutineWaiter::ptr {
+    if (waiters.empty()) {
+      return nullptr;
+    }
+    CoroutineWaiter::ptr waiter = std::move(waiters.front());
+    waiters.pop();
+    return waiter;
+  }
+
+  /**
+   * @brief 在持有 lock 时取出一个值并唤醒一个等待的发送者
+   */
+  auto TakeItem(T *value, Mutex::Locker &lock) -> bool {
+    if (items_.empty()) {
+      return false;
+    }
+    *value = std::move(items_.front());
+    items_.pop();
+    CoroutineWaiter::ptr sender = PopWaiter(send_waiters_);
+    lock.Unlock();
+
+    if (sender != nullptr) {
+      sender->Wake();
+    }
+    return true;
+  }
+
+ private:
+  size_t capacity_{1};
+  bool is_closed_{false};
+  std::queue<T> items_;
+
+  // woken one per item or free slot, they check again after they are resumed
+  std::queue<CoroutineWaiter::ptr> send_waiters_;
+  std::queue<CoroutineWaiter::ptr> recv_waiters_;
+
+  Mutex mutex_;
+};
+
+}  // namespace tirpc
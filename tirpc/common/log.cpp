@@ -10,12 +10,10 @@
 #include <unistd.h>
 #include <cassert>
 #include <cerrno>
-#include <chrono>
 #include <csignal>
 #include <cstdio>
 #include <cstring>
 #include <ctime>
-#include <iomanip>
 #include <iostream>
 #include <sstream>
 
@@ -154,21 +152,22 @@ auto LogTypeToString(LogType logtype) -> std::string {
 }
 
 static auto GetTimeString() -> std::string {
-  // 获取当前时间点
-  auto now = std::chrono::system_clock::now();
-  // 将时间点转换为 std::time_t 类型
-  std::time_t currentTime = std::chrono::system_clock::to_time_t(now);
-  // 获取毫秒部分
-  auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(now.time_since_epoch()) % 1000;
-
-  // 转换为本地时间
-  std::tm *localTime = std::localtime(&currentTime);
-
-  // 用于存储格式化后的时间字符串
-  std::ostringstream oss;
-  oss << std::put_time(localTime, "%Y-%m-%d %H:%M:%S.") << std::setfill('0') << std::setw(3) << ms.count();
+  // 日志需要墙上时间，同一秒内的日期部分只格式化一次，避免每行都调用 localtime
+  static thread_local time_t t_last_sec = -1;
+  static thread_local char t_sec_str[32];
+
+  timespec now;
+  clock_gettime(CLOCK_REALTIME, &now);
+  if (now.tv_sec != t_last_sec) {
+    struct tm local_time;
+    localtime_r(&now.tv_sec, &local_time);
+    strftime(t_sec_str, sizeof(t_sec_str), "%Y-%m-%d %H:%M:%S", &local_time);
+    t_last_sec = now.tv_sec;
+  }
 
-  return oss.str();
+  char buf[48];
+  snprintf(buf, sizeof(buf), "%s.%03ld", t_sec_str, now.tv_nsec / 1000000);
+  return buf;
 }
 
 // 将字符串调整到指定长度，过长则截断，过短则填充
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <atomic>
+
+namespace tirpc {
+
+/**
+ * @brief 侵入式无锁多生产者单消费者队列(Vyukov MPSC)
+ *
+ * Node 需要有 std::atomic<Node *> next_ 成员，节点内存由调用方管理，队列本身不分配内存。
+ * Push 可以被任意线程并发调用，只需要一次原子交换；Pop 只能由唯一的消费者线程调用
+ */
+template <class Node>
+class MpscQueue {
+ public:
+  MpscQueue() : head_(&stub_), tail_(&stub_) { stub_.next_.store(nullptr, std::memory_order_relaxed); }
+
+  MpscQueue(const MpscQueue &) = delete;
+  auto operator=(const MpscQueue &) -> MpscQueue & = delete;
+
+  void Push(Node *node) {
+    node->next_.store(nullptr, std::memory_order_relaxed);
+    // seq_cst, so that consumer checks Empty before sleep and producer checks whether to wake it can't both miss
+    Node *prev = head_.exchange(node, std::memory_order_seq_cst);
+    // between exchange and this store, consumer can't see node and the ones pushed after it
+    prev->next_.store(node, std::memory_order_release);
+  }
+
+  /**
+   * @brief 取出队首节点，队列为空或者生产者正在 Push 时返回 nullptr
+   */
+  auto Pop() -> Node * {
+    Node *tail = tail_;
+    Node *next = tail->next_.load(std::memory_order_acquire);
+    if (tail == &stub_) {
+      if (next == nullptr) {
+        return nullptr;
+      }
+      tail_ = next;
+      tail = next;
+      next = next->next_.load(std::memory_order_acquire);
+    }
+    if (next != nullptr) {
+      tail_ = next;
+      return tail;
+    }
+    if (tail != head_.load(std::memory_order_acquire)) {
+      // a producer is pushing, the node will be seen after its Push finished
+      return nullptr;
+    }
+    // tail is the last node, push stub behind it so that tail can be popped
+    Push(&stub_);
+    next = tail->next_.load(std::memory_order_acquire);
+    if (next != nullptr) {
+      tail_ = next;
+      return tail;
+    }
+    return nullptr;
+  }
+
+  /**
+   * @brief 只能由消费者线程调用，生产者正在 Push 的节点也算在内
+   */
+  auto Empty() const -> bool { return tail_ == &stub_ && head_.load(std::memory_order_seq_cst) == &stub_; }
+
+ private:
+  std::atomic<Node *> head_;  // producers push here
+  Node *tail_;                // only touched by consumer
+  Node stub_;
+};
+
+}  // namespace tirpc
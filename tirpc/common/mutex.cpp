@@ -2,6 +2,7 @@
 
 #include <pthread.h>
 #include <memory>
+#include <utility>
 
 #include "tirpc/common/log.hpp"
 #include "tirpc/coroutine/coroutine.hpp"
@@ -12,6 +13,39 @@
 
 namespace tirpc {
 
+CoroutineWaiter::CoroutineWaiter()
+    : cor_(Coroutine::GetCurrentCoroutine()->weak_from_this()),
+      generation_(Coroutine::GetCurrentCoroutine()->GetGeneration()),
+      reactor_(Reactor::GetReactor()) {}
+
+void CoroutineWaiter::Wait() {
+  is_waiting_ = true;
+  // Wake may come before it yields, its resume task still runs after that, so always yield to consume it
+  do {
+    Coroutine::Yield();
+  } while (!is_woken_.load(std::memory_order_acquire));
+  is_waiting_ = false;
+}
+
+void CoroutineWaiter::Wake() {
+  is_woken_.store(true, std::memory_order_release);
+  // resumed by the reactor it waits in, it can't run before it yields since that thread is running it now
+  reactor_->AddTask([waiter = shared_from_this()]() { waiter->ResumeIfWaiting(); }, true);
+}
+
+void CoroutineWaiter::ResumeIfWaiting() {
+  if (!is_waiting_) {
+    // resumed by others and it has left Wait, don't resume it where it's parked now
+    return;
+  }
+  Coroutine::ptr cor = cor_.lock();
+  if (cor == nullptr || cor->GetGeneration() != generation_) {
+    // released, or returned to pool though it's parked here and reused by new function
+    return;
+  }
+  Coroutine::Resume(cor.get());
+}
+
 CoroutineMutex::CoroutineMutex() = default;
 
 CoroutineMutex::~CoroutineMutex() {
@@ -26,48 +60,127 @@ void CoroutineMutex::Lock() {
     return;
   }
 
-  Coroutine *cor = Coroutine::GetCurrentCoroutine();
-
   Mutex::Locker lock(mutex_);
   if (!lock_) {
     lock_ = true;
-    LOG_DEBUG << "coroutine succ get coroutine mutex";
-    lock.Unlock();
-  } else {
-    sleep_cors_.push(cor);
-    auto tmp = sleep_cors_;
-    lock.Unlock();
-
-    LOG_DEBUG << "coroutine yield, pending coroutine mutex, current sleep queue exist [" << tmp.size() << "] coroutines";
+    return;
+  }
+  auto waiter = std::make_shared<CoroutineWaiter>();
+  sleep_cors_.push(waiter);
+  LOG_DEBUG << "coroutine yield, pending coroutine mutex, current sleep queue exist [" << sleep_cors_.size()
+            << "] coroutines";
+  lock.Unlock();
+
+  // lock is handed to it by Unlock
+  waiter->Wait();
+}
 
-    Coroutine::Yield();
+auto CoroutineMutex::TryLock() -> bool {
+  Mutex::Locker lock(mutex_);
+  if (lock_) {
+    return false;
   }
+  lock_ = true;
+  return true;
 }
 
 void CoroutineMutex::Unlock() {
+  Mutex::Locker lock(mutex_);
+  if (!lock_) {
+    return;
+  }
+  if (sleep_cors_.empty()) {
+    lock_ = false;
+    return;
+  }
+  // lock_ keeps true, the first cor in sleep queue owns it now
+  CoroutineWaiter::ptr waiter = std::move(sleep_cors_.front());
+  sleep_cors_.pop();
+  lock.Unlock();
+
+  waiter->Wake();
+}
+
+void CoroutineCondVar::Wait(CoroutineMutex &mutex) {
   if (Coroutine::IsMainCoroutine()) {
-    LOG_ERROR << "main coroutine can't use coroutine mutex";
+    LOG_ERROR << "main coroutine can't wait on coroutine condition variable";
     return;
   }
 
+  auto waiter = std::make_shared<CoroutineWaiter>();
   Mutex::Locker lock(mutex_);
-  if (lock_) {
-    lock_ = false;
-    if (sleep_cors_.empty()) {
-      return;
-    }
+  // it's queued before mutex is released, notify after that can't be lost
+  waiters_.push(waiter);
+  lock.Unlock();
+
+  mutex.Unlock();
+  waiter->Wait();
+  mutex.Lock();
+}
+
+void CoroutineCondVar::NotifyOne() {
+  Mutex::Locker lock(mutex_);
+  if (waiters_.empty()) {
+    return;
+  }
+  CoroutineWaiter::ptr waiter = std::move(waiters_.front());
+  waiters_.pop();
+  lock.Unlock();
+
+  waiter->Wake();
+}
+
+void CoroutineCondVar::NotifyAll() {
+  std::queue<CoroutineWaiter::ptr> waiters;
+  Mutex::Locker lock(mutex_);
+  waiters.swap(waiters_);
+  lock.Unlock();
+
+  while (!waiters.empty()) {
+    waiters.front()->Wake();
+    waiters.pop();
+  }
+}
 
-    Coroutine *cor = sleep_cors_.front();
-    sleep_cors_.pop();
-    lock.Unlock();
+void CoroutineSemaphore::Wait() {
+  if (Coroutine::IsMainCoroutine()) {
+    LOG_ERROR << "main coroutine can't wait on coroutine semaphore";
+    return;
+  }
+
+  Mutex::Locker lock(mutex_);
+  if (count_ > 0) {
+    --count_;
+    return;
+  }
+  auto waiter = std::make_shared<CoroutineWaiter>();
+  waiters_.push(waiter);
+  lock.Unlock();
 
-    if (cor != nullptr) {
-      // wakeup the first cor in sleep queue
-      LOG_DEBUG << "coroutine unlock, now to resume coroutine[" << cor->GetCorId() << "]";
+  // count is handed to it by Post
+  waiter->Wait();
+}
 
-      Reactor::GetReactor()->AddTask([cor]() { Coroutine::Resume(cor); }, true);
-    }
+auto CoroutineSemaphore::TryWait() -> bool {
+  Mutex::Locker lock(mutex_);
+  if (count_ == 0) {
+    return false;
   }
+  --count_;
+  return true;
+}
+
+void CoroutineSemaphore::Post() {
+  Mutex::Locker lock(mutex_);
+  if (waiters_.empty()) {
+    ++count_;
+    return;
+  }
+  CoroutineWaiter::ptr waiter = std::move(waiters_.front());
+  waiters_.pop();
+  lock.Unlock();
+
+  waiter->Wake();
 }
 
 }  // namespace tirpc
\ No newline at end of file
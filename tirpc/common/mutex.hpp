@@ -1,6 +1,8 @@
 #pragma once
 
 #include <pthread.h>
+#include <atomic>
+#include <cstdint>
 #include <memory>
 #include <queue>
 
@@ -145,6 +147,51 @@ class RWMutex {
 
 class Coroutine;
 
+class Reactor;
+
+/**
+ * @brief 挂起在协程同步原语上的一个协程，由它挂起时所在线程的 Reactor 恢复，所以可以在任意线程唤醒
+ * 唤醒方只访问这个堆上的对象，不会写协程的栈（共享栈上的协程挂起时栈已经被拷贝出去）
+ * 只能用 std::make_shared 创建，投递的恢复任务持有它，协程已经离开 Wait、被释放或者被复用时不会被恢复
+ */
+class CoroutineWaiter : public std::enable_shared_from_this<CoroutineWaiter> {
+ public:
+  using ptr = std::shared_ptr<CoroutineWaiter>;
+
+  /**
+   * @brief 记录当前协程和当前线程的 Reactor，只能在协程中调用
+   */
+  CoroutineWaiter();
+
+  /**
+   * @brief 挂起当前协程直到被 Wake，被其他原因恢复时继续挂起
+   * 挂起前已经被 Wake 时也要挂起一次，由 Wake 投递的任务恢复
+   */
+  void Wait();
+
+  /**
+   * @brief 把恢复协程的任务投递到它的 Reactor，可以在任意线程调用，只能调用一次
+   */
+  void Wake();
+
+ private:
+  /**
+   * @brief 在协程所在的 Reactor 上执行，协程仍然挂起在这次 Wait 中时才恢复它
+   */
+  void ResumeIfWaiting();
+
+ private:
+  std::weak_ptr<Coroutine> cor_;
+  uint64_t generation_{0};  // generation of cor_ when it waits
+  Reactor *reactor_{nullptr};
+  bool is_waiting_{false};  // only touched by the thread of reactor_
+  std::atomic<bool> is_woken_{false};
+};
+
+/**
+ * @brief 协程互斥锁，拿不到锁时挂起当前协程而不是阻塞 IO 线程
+ * Unlock 时锁直接交给等待最久的协程，被唤醒的协程不需要再抢锁
+ */
 class CoroutineMutex {
  public:
   using Locker = ScopedLockImpl<CoroutineMutex>;
@@ -153,14 +200,88 @@ class CoroutineMutex {
 
   ~CoroutineMutex();
 
+  /**
+   * @brief 加锁，锁被占用时挂起当前协程，只能在协程中调用
+   */
   void Lock();
 
+  /**
+   * @brief 尝试加锁，不会挂起
+   */
+  auto TryLock() -> bool;
+
+  /**
+   * @brief 解锁，可以在任意线程调用
+   */
   void Unlock();
 
  private:
   bool lock_{false};
+  Mutex mutex_;  // protects lock_ and sleep_cors_, it's held for only a few instructions
+  std::queue<CoroutineWaiter::ptr> sleep_cors_;
+};
+
+/**
+ * @brief 协程条件变量，配合 CoroutineMutex 使用
+ */
+class CoroutineCondVar {
+ public:
+  /**
+   * @brief 释放 mutex 并挂起当前协程，被唤醒后重新加锁再返回，调用前 mutex 必须已经加锁
+   */
+  void Wait(CoroutineMutex &mutex);
+
+  /**
+   * @brief 挂起直到 pred 返回 true，pred 在持有 mutex 时调用
+   */
+  template <class Predicate>
+  void Wait(CoroutineMutex &mutex, Predicate pred) {
+    while (!pred()) {
+      Wait(mutex);
+    }
+  }
+
+  /**
+   * @brief 唤醒一个等待的协程，可以在任意线程调用
+   */
+  void NotifyOne();
+
+  /**
+   * @brief 唤醒所有等待的协程，可以在任意线程调用
+   */
+  void NotifyAll();
+
+ private:
+  Mutex mutex_;
+  std::queue<CoroutineWaiter::ptr> waiters_;
+};
+
+/**
+ * @brief 协程信号量，计数为 0 时 Wait 挂起当前协程，Post 时计数直接交给等待最久的协程
+ */
+class CoroutineSemaphore {
+ public:
+  explicit CoroutineSemaphore(int64_t count = 0) : count_(count) {}
+
+  /**
+   * @brief 计数减一，计数为 0 时挂起当前协程，只能在协程中调用
+   */
+  void Wait();
+
+  /**
+   * @brief 尝试减一，计数为 0 时返回 false，不会挂起
+   */
+  auto TryWait() -> bool;
+
+  /**
+   * @brief 计数加一或者唤醒一个等待的协程，可以在任意线程调用
+   */
+  void Post();
+
+ private:
+  int64_t count_{0};
   Mutex mutex_;
-  std::queue<Coroutine *> sleep_cors_;
+  std::queue<CoroutineWaiter::ptr> waiters_;
 };
 
 }  // namespace tirpc
\ No newline at end of file
@@ -1,8 +1,11 @@
 #include "tirpc/common/util.hpp"
 
 #include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
 #include <sys/stat.h>
 #include <unistd.h>
+#include <cstring>
 #include <fstream>
 #include <iostream>
 #include <map>
@@ -62,6 +65,22 @@ void StringUtil::SplitStrToVector(std::string_view str, const std::string &split
   }
 }
 
+auto ThreadUtil::BindCpu(int cpu) -> bool {
+  if (cpu < 0 || cpu >= CPU_SETSIZE) {
+    LOG_ERROR << "invalid cpu [" << cpu << "]";
+    return false;
+  }
+  cpu_set_t cpu_set;
+  CPU_ZERO(&cpu_set);
+  CPU_SET(cpu, &cpu_set);
+  int rt = pthread_setaffinity_np(pthread_self(), sizeof(cpu_set), &cpu_set);
+  if (rt != 0) {
+    LOG_ERROR << "bind thread to cpu [" << cpu << "] error, sys errinfo = " << strerror(rt);
+    return false;
+  }
+  return true;
+}
+
 auto FileUtil::IsDirectory(const std::string &path) -> bool {
   struct stat pathStat;
   // 获取文件状态信息
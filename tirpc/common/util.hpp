@@ -21,6 +21,12 @@ class StringUtil {
   static void SplitStrToVector(std::string_view str, const std::string &split_str, std::vector<std::string> &res);
 };
 
+class ThreadUtil {
+ public:
+  // bind current thread to cpu, memory it touches first is allocated on the numa node of this cpu
+  static auto BindCpu(int cpu) -> bool;
+};
+
 class FileUtil {
  public:
   static auto IsDirectory(const std::string &path) -> bool;
@@ -0,0 +1,131 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace tirpc {
+
+/**
+ * @brief Chase-Lev 无锁工作窃取双端队列(Lê et al. 2013 的 C11 版本)
+ *
+ * 只有一个所有者线程可以调用 Push 和 Pop，在队列底部操作，大多数情况下没有原子读改写；
+ * 其他线程调用 Steal 从队列顶部窃取。T 必须是指针等可以原子读写的小类型，空队列返回 T{}
+ */
+template <class T>
+class WorkStealDeque {
+ public:
+  explicit WorkStealDeque(int64_t capacity = 256) {
+    int64_t cap = 1;
+    while (cap < capacity) {
+      cap <<= 1;
+    }
+    buffers_.push_back(std::make_unique<Buffer>(cap));
+    buffer_.store(buffers_.back().get(), std::memory_order_relaxed);
+  }
+
+  WorkStealDeque(const WorkStealDeque &) = delete;
+  auto operator=(const WorkStealDeque &) -> WorkStealDeque & = delete;
+
+  /**
+   * @brief 所有者线程把任务放到队列底部，队列满时扩容
+   */
+  void Push(T item) {
+    int64_t b = bottom_.load(std::memory_order_relaxed);
+    int64_t t = top_.load(std::memory_order_acquire);
+    Buffer *buf = buffer_.load(std::memory_order_relaxed);
+    if (b - t > buf->mask_) {
+      buf = Grow(buf, b, t);
+    }
+    buf->Put(b, item);
+    std::atomic_thread_fence(std::memory_order_release);
+    bottom_.store(b + 1, std::memory_order_relaxed);
+  }
+
+  /**
+   * @brief 所有者线程从队列底部取任务，只有和窃取者竞争最后一个任务时才需要 CAS
+   */
+  auto Pop() -> T {
+    int64_t b = bottom_.load(std::memory_order_relaxed) - 1;
+    Buffer *buf = buffer_.load(std::memory_order_relaxed);
+    bottom_.store(b, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t t = top_.load(std::memory_order_relaxed);
+    if (t > b) {
+      // empty
+      bottom_.store(b + 1, std::memory_order_relaxed);
+      return T{};
+    }
+    T item = buf->Get(b);
+    if (t == b) {
+      // last one, race with thieves
+      if (!top_.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+        item = T{};
+      }
+      bottom_.store(b + 1, std::memory_order_relaxed);
+    }
+    return item;
+  }
+
+  /**
+   * @brief 其他线程从队列顶部窃取一个任务，队列为空或者和其他线程竞争失败时返回 T{}
+   */
+  auto Steal() -> T {
+    int64_t t = top_.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t b = bottom_.load(std::memory_order_acquire);
+    if (t >= b) {
+      return T{};
+    }
+    // consume ordering, buffer replaced by owner is kept alive until deque destroyed
+    Buffer *buf = buffer_.load(std::memory_order_acquire);
+    T item = buf->Get(t);
+    if (!top_.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+      return T{};
+    }
+    return item;
+  }
+
+  /**
+   * @brief 队列中任务数的近似值，其他线程调用时只能用来做决策参考
+   */
+  auto Size() const -> int64_t {
+    int64_t b = bottom_.load(std::memory_order_acquire);
+    int64_t t = top_.load(std::memory_order_acquire);
+    return b > t ? b - t : 0;
+  }
+
+  auto Empty() const -> bool { return Size() == 0; }
+
+ private:
+  struct Buffer {
+    explicit Buffer(int64_t capacity) : mask_(capacity - 1), items_(new std::atomic<T>[capacity]) {}
+
+    auto Get(int64_t i) const -> T { return items_[i & mask_].load(std::memory_order_relaxed); }
+
+    void Put(int64_t i, T item) { items_[i & mask_].store(item, std::memory_order_relaxed); }
+
+    int64_t mask_;
+    std::unique_ptr<std::atomic<T>[]> items_;
+  };
+
+  auto Grow(Buffer *old, int64_t b, int64_t t) -> Buffer * {
+    buffers_.push_back(std::make_unique<Buffer>((old->mask_ + 1) * 2));
+    Buffer *buf = buffers_.back().get();
+    for (int64_t i = t; i < b; ++i) {
+      buf->Put(i, old->Get(i));
+    }
+    // thieves may still read the old buffer, it's released with the deque
+    buffer_.store(buf, std::memory_order_release);
+    return buf;
+  }
+
+ private:
+  alignas(64) std::atomic<int64_t> top_{0};     // thieves steal here
+  alignas(64) std::atomic<int64_t> bottom_{0};  // owner push and pop here
+  std::atomic<Buffer *> buffer_{nullptr};
+  std::vector<std::unique_ptr<Buffer>> buffers_;  // only touched by owner
+};
+
+}  // namespace tirpc
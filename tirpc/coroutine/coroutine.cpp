@@ -69,6 +69,18 @@ Coroutine::Coroutine(int size, char *stack_ptr, std::function<void()> cb) : stac
   t_coroutine_count++;
 }
 
+Coroutine::Coroutine(SharedStack *stack)
+    : stack_size_(stack->stack_size_), stack_sp_(stack->stack_sp_), shared_stack_(stack) {
+  assert(stack->stack_sp_ != nullptr);
+
+  if (t_main_coroutine == nullptr) {
+    t_main_coroutine = new Coroutine();
+  }
+
+  cor_id_ = t_current_coroutine_id++;
+  t_coroutine_count++;
+}
+
 auto Coroutine::SetCallBack(std::function<void()> cb) -> bool {
   if (this == t_main_coroutine) {
     LOG_ERROR << "main coroutine cannot set callback";
@@ -81,8 +93,13 @@ auto Coroutine::SetCallBack(std::function<void()> cb) -> bool {
   }
 
   callback_ = cb;
+  generation_.fetch_add(1, std::memory_order_release);
+
+  // frames of last function are useless
+  ReleaseSavedStack();
 
-  char *top = stack_sp_ + stack_size_;
+  // coctx_swap writes return address at rsp, keep it inside the stack, or it hits the guard page of next stack
+  char *top = stack_sp_ + stack_size_ - sizeof(void *);
 
   top = reinterpret_cast<char *>((reinterpret_cast<uint64_t>(top)) & -16LL);
 
@@ -99,6 +116,58 @@ auto Coroutine::SetCallBack(std::function<void()> cb) -> bool {
 
 Coroutine::~Coroutine() { t_coroutine_count--; }
 
+void Coroutine::ReleaseSavedStack() {
+  if (shared_stack_ == nullptr) {
+    return;
+  }
+  if (shared_stack_->occupant_ == this) {
+    shared_stack_->occupant_ = nullptr;
+  }
+  saved_stack_.reset();
+  saved_size_ = 0;
+  saved_capacity_ = 0;
+}
+
+void Coroutine::SaveStack() {
+  if (!is_in_cofunc_) {
+    // its function has finished, nobody resumes it before SetCallBack
+    saved_size_ = 0;
+    return;
+  }
+  // it's yielded in coctx_swap, rsp saved there is the lowest address it uses
+  char *sp = static_cast<char *>(coctx_.regs_[kRSP]);
+  size_t size = stack_sp_ + stack_size_ - sp;
+  if (size > saved_capacity_ || size < saved_capacity_ / 2) {
+    // keep it right-sized, idle coroutines hold only what they use
+    saved_stack_.reset(new char[size]);
+    saved_capacity_ = size;
+  }
+  memcpy(saved_stack_.get(), sp, size);
+  saved_size_ = size;
+}
+
+auto Coroutine::TakeSharedStack() -> bool {
+  SharedStack *stack = shared_stack_;
+  if (stack->owner_tid_ != GetTid()) {
+    LOG_ERROR << "coroutine[" << cor_id_ << "] runs on shared stack of thread " << stack->owner_tid_
+              << ", it can't be resumed by other threads";
+    return false;
+  }
+  if (stack->occupant_ == this) {
+    return true;
+  }
+  if (stack->occupant_ != nullptr) {
+    stack->occupant_->SaveStack();
+  }
+  // it runs on main coroutine's stack, overwriting shared stack is safe
+  if (saved_size_ > 0) {
+    memcpy(stack_sp_ + stack_size_ - saved_size_, saved_stack_.get(), saved_size_);
+    saved_size_ = 0;
+  }
+  stack->occupant_ = this;
+  return true;
+}
+
 auto Coroutine::GetCurrentCoroutine() -> Coroutine * {
   if (t_current_coroutine == nullptr) {
     t_main_coroutine = new Coroutine();
@@ -158,10 +227,17 @@ void Coroutine::Resume(Coroutine *co) {
     return;
   }
 
+  if (co->shared_stack_ != nullptr && !co->TakeSharedStack()) {
+    return;
+  }
+
   t_current_coroutine = co;
   t_current_runtime = co->GetRuntime();
 
+  co->is_running_.store(true, std::memory_order_relaxed);
   CoctxSwap(&(t_main_coroutine->coctx_), &(co->coctx_));
+  // it has yielded, other threads may release it from now on
+  co->is_running_.store(false, std::memory_order_release);
 }
 
 }  // namespace tirpc
\ No newline at end of file
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <sys/types.h>
+#include <atomic>
 #include <functional>
 #include <memory>
 #include <string>
@@ -8,6 +10,21 @@
 
 namespace tirpc {
 
+class CoroutinePool;
+
+class Coroutine;
+
+/**
+ * @brief 共享栈，多个协程轮流在上面运行，只能由所属线程使用
+ * 恢复另一个协程时，当前占用者已经用到的那部分栈被拷贝到它自己的堆内存中，轮到它时再拷贝回来
+ */
+struct SharedStack {
+  char *stack_sp_{nullptr};
+  int stack_size_{0};
+  pid_t owner_tid_{0};            // thread which resumes coroutines on it
+  Coroutine *occupant_{nullptr};  // coroutine whose frames are on the stack now
+};
+
 struct Runtime {
   std::string msg_no_;
   std::string interface_name_;
@@ -19,7 +36,7 @@ auto GetCurrentRuntime() -> Runtime *;
 
 void SetCurrentRuntime(Runtime *runtime);
 
-class Coroutine {
+class Coroutine : public std::enable_shared_from_this<Coroutine> {
  public:
  public:
   using ptr = std::shared_ptr<Coroutine>;
@@ -32,6 +49,11 @@ class Coroutine {
 
   Coroutine(int size, char *stack_ptr, std::function<void()> cb);
 
+  /**
+   * @brief 在共享栈上运行的协程，让出后栈上的内容被拷贝出去，只能由共享栈所属的线程恢复
+   */
+  explicit Coroutine(SharedStack *stack);
+
   ~Coroutine();
 
   auto SetCallBack(std::function<void()> cb) -> bool;
@@ -52,12 +74,38 @@ class Coroutine {
 
   auto GetIndex() -> int { return index_; }
 
+  void SetPool(CoroutinePool *pool) { pool_ = pool; }
+
+  auto GetPool() -> CoroutinePool * { return pool_; }
+
   auto GetStackPtr() -> char * { return stack_sp_; }
 
   auto GetStackSize() -> int { return stack_size_; }
 
   void SetCanResume(bool v) { can_resume_ = v; }
 
+  auto IsSharedStack() const -> bool { return shared_stack_ != nullptr; }
+
+  /**
+   * @brief 从共享栈上拷贝出去的字节数，协程占用着共享栈或者没有拷贝过时为 0
+   */
+  auto GetSavedStackSize() const -> size_t { return saved_size_; }
+
+  /**
+   * @brief 丢弃拷贝出去的栈并放弃对共享栈的占用，协程的函数不会再被恢复时才能调用
+   */
+  void ReleaseSavedStack();
+
+  /**
+   * @brief 协程是否正在某个线程上运行，被窃取的协程可能在其它 IO 线程上运行，释放它的资源前需要检查
+   */
+  auto IsRunning() const -> bool { return is_running_.load(std::memory_order_acquire); }
+
+  /**
+   * @brief 每次 SetCallBack 加一，协程被复用运行新的函数后，之前记下的代数就对不上了
+   */
+  auto GetGeneration() const -> uint64_t { return generation_.load(std::memory_order_acquire); }
+
  public:
   static void Yield();
 
@@ -71,6 +119,17 @@ class Coroutine {
 
   // static void SetCoroutineSwapFlag(bool value);
 
+ private:
+  /**
+   * @brief 恢复前让协程占用它的共享栈，把原来的占用者拷贝出去，再把自己的栈拷贝回来
+   */
+  auto TakeSharedStack() -> bool;
+
+  /**
+   * @brief 把已经让出的协程在共享栈上用到的部分拷贝到 saved_stack_
+   */
+  void SaveStack();
+
   // static bool GetCoroutineSwapFlag();
 
  private:
@@ -86,8 +145,19 @@ class Coroutine {
 
   bool can_resume_{true};
 
+  std::atomic<bool> is_running_{false};  // true from Resume until it yields back
+
+  std::atomic<uint64_t> generation_{0};  // which function it runs, see GetGeneration
+
   int index_{-1};  // index in coroutine pool
 
+  CoroutinePool *pool_{nullptr};  // pool it's taken from, it's returned to that pool
+
+  SharedStack *shared_stack_{nullptr};   // nullptr if it owns stack_sp_
+  std::unique_ptr<char[]> saved_stack_;  // frames copied out of shared stack
+  size_t saved_size_{0};                 // bytes used in saved_stack_
+  size_t saved_capacity_{0};
+
  public:
   std::function<void()> callback_{nullptr};
 };
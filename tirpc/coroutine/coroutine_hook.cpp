@@ -4,16 +4,19 @@
 #include <asm-generic/errno.h>
 #include <dlfcn.h>
 #include <fcntl.h>
+#include <poll.h>
 #include <unistd.h>
 #include <cassert>
 #include <cstring>
 #include <iostream>
+#include <memory>
 
 #include "tirpc/common/config.hpp"
 #include "tirpc/common/log.hpp"
 #include "tirpc/coroutine/coroutine.hpp"
 
 #include "tirpc/net/base/fd_event.hpp"
+#include "tirpc/net/base/io_uring.hpp"
 #include "tirpc/net/base/reactor.hpp"
 #include "tirpc/net/base/timer.hpp"
 
@@ -37,6 +40,19 @@ static bool g_hook = true;
 
 void SetHook(bool value) { g_hook = value; }
 
+#ifdef TIRPC_HAS_IO_URING
+/**
+ * @brief 当前协程可以使用的 io_uring，没有时返回 nullptr
+ * 请求在协程挂起时完成，完成结果和数据会写入它的栈，共享栈上的协程挂起时栈已经被拷贝出去，只能使用 epoll
+ */
+static auto GetIoUringOfCurrentCoroutine() -> tirpc::IoUring * {
+  if (tirpc::Coroutine::GetCurrentCoroutine()->IsSharedStack()) {
+    return nullptr;
+  }
+  return tirpc::Reactor::GetReactor()->GetIoUring();
+}
+#endif
+
 void toEpoll(tirpc::FdEvent::ptr fd_event, int events) {
   tirpc::Coroutine *cur_cor = tirpc::Coroutine::GetCurrentCoroutine();
   if (events & tirpc::IOEvent::READ) {
@@ -76,6 +92,14 @@ ssize_t recv_hook(int fd, void *buf, size_t count, int flag) {
     return n;
   }
 
+#ifdef TIRPC_HAS_IO_URING
+  // io_uring copies data into buf when it's ready, no need to wake up and call the syscall again
+  tirpc::IoUring *ring = GetIoUringOfCurrentCoroutine();
+  if (ring != nullptr && n < 0 && errno == EAGAIN && ring->Recv(fd, buf, count, flag, &n)) {
+    return n;
+  }
+#endif
+
   toEpoll(fd_event, tirpc::IOEvent::READ);
 
   LOG_DEBUG << "recv func to yield";
@@ -109,6 +133,14 @@ ssize_t send_hook(int fd, const void *buf, size_t count, int flag) {
     return n;
   }
 
+#ifdef TIRPC_HAS_IO_URING
+  // io_uring copies data into buf when it's ready, no need to wake up and call the syscall again
+  tirpc::IoUring *ring = GetIoUringOfCurrentCoroutine();
+  if (ring != nullptr && n < 0 && errno == EAGAIN && ring->Send(fd, buf, count, flag, &n)) {
+    return n;
+  }
+#endif
+
   toEpoll(fd_event, tirpc::IOEvent::WRITE);
 
   LOG_DEBUG << "send func to yield";
@@ -122,6 +154,71 @@ ssize_t send_hook(int fd, const void *buf, size_t count, int flag) {
   return send(fd, buf, count, flag);
 }
 
+void wait_writable_hook(int fd) {
+  LOG_DEBUG << "this is hook wait writable";
+  if (tirpc::Coroutine::IsMainCoroutine()) {
+    LOG_DEBUG << "hook disable, call sys poll func";
+    struct pollfd pfd = {fd, POLLOUT, 0};
+    poll(&pfd, 1, -1);
+    return;
+  }
+
+  tirpc::FdEvent::ptr fd_event = tirpc::FdEventContainer::GetFdContainer()->GetFdEvent(fd);
+  if (fd_event->GetReactor() == nullptr) {
+    fd_event->SetReactor(tirpc::Reactor::GetReactor());
+  }
+
+#ifdef TIRPC_HAS_IO_URING
+  tirpc::IoUring *ring = GetIoUringOfCurrentCoroutine();
+  int revents = 0;
+  if (ring != nullptr && ring->Poll(fd, POLLOUT, &revents)) {
+    return;
+  }
+#endif
+
+  toEpoll(fd_event, tirpc::IOEvent::WRITE);
+
+  LOG_DEBUG << "wait writable func to yield";
+  tirpc::Coroutine::Yield();
+
+  fd_event->DelListenEvents(tirpc::IOEvent::WRITE);
+  fd_event->ClearCoroutine();
+}
+
+int wait_events_hook(int fd, int events) {
+  LOG_DEBUG << "this is hook wait events";
+  struct pollfd pfd = {fd, static_cast<short>(events), 0};
+  if (tirpc::Coroutine::IsMainCoroutine()) {
+    LOG_DEBUG << "hook disable, call sys poll func";
+    poll(&pfd, 1, -1);
+    return pfd.revents;
+  }
+  if (poll(&pfd, 1, 0) > 0) {
+    return pfd.revents;
+  }
+
+  tirpc::FdEvent::ptr fd_event = tirpc::FdEventContainer::GetFdContainer()->GetFdEvent(fd);
+  if (fd_event->GetReactor() == nullptr) {
+    fd_event->SetReactor(tirpc::Reactor::GetReactor());
+  }
+
+  // io_uring poll can't see events added by others, so don't use it here
+  toEpoll(fd_event, events);
+
+  LOG_DEBUG << "wait events func to yield";
+  tirpc::Coroutine::Yield();
+
+  // check what others added too
+  pfd.events = static_cast<short>(fd_event->GetListenEvents() | events);
+  fd_event->DelListenEvents(tirpc::IOEvent::READ);
+  fd_event->DelListenEvents(tirpc::IOEvent::WRITE);
+  fd_event->ClearCoroutine();
+
+  pfd.revents = 0;
+  poll(&pfd, 1, 0);
+  return pfd.revents;
+}
+
 ssize_t read_hook(int fd, void *buf, size_t count) {
   LOG_DEBUG << "this is hook read";
   if (tirpc::Coroutine::IsMainCoroutine()) {
@@ -153,6 +250,14 @@ ssize_t read_hook(int fd, void *buf, size_t count) {
     return n;
   }
 
+#ifdef TIRPC_HAS_IO_URING
+  // io_uring copies data into buf when it's ready, no need to wake up and call the syscall again
+  tirpc::IoUring *ring = GetIoUringOfCurrentCoroutine();
+  if (ring != nullptr && n < 0 && errno == EAGAIN && ring->Read(fd, buf, count, &n)) {
+    return n;
+  }
+#endif
+
   toEpoll(fd_event, tirpc::IOEvent::READ);
 
   LOG_DEBUG << "read func to yield";
@@ -187,7 +292,16 @@ int accept_hook(int sockfd, struct sockaddr *addr, socklen_t *addrlen) {
 
   fd_event->SetNonBlock();
 
-  int n = g_sys_accept_fun(sockfd, addr, addrlen);
+  int n = -1;
+#ifdef TIRPC_HAS_IO_URING
+  // one multishot accept keeps accepting for this listen fd, connections come with completions
+  tirpc::IoUring *ring = GetIoUringOfCurrentCoroutine();
+  if (ring != nullptr && ring->Accept(sockfd, addr, addrlen, &n)) {
+    return n;
+  }
+#endif
+
+  n = g_sys_accept_fun(sockfd, addr, addrlen);
   if (n > 0) {
     return n;
   }
@@ -230,6 +344,14 @@ ssize_t write_hook(int fd, const void *buf, size_t count) {
     return n;
   }
 
+#ifdef TIRPC_HAS_IO_URING
+  // io_uring copies data into buf when it's ready, no need to wake up and call the syscall again
+  tirpc::IoUring *ring = GetIoUringOfCurrentCoroutine();
+  if (ring != nullptr && n < 0 && errno == EAGAIN && ring->Write(fd, buf, count, &n)) {
+    return n;
+  }
+#endif
+
   toEpoll(fd_event, tirpc::IOEvent::WRITE);
 
   LOG_DEBUG << "write func to yield";
@@ -275,14 +397,13 @@ int connect_hook(int sockfd, const struct sockaddr *addr, socklen_t addrlen) {
 
   LOG_DEBUG << "errno == EINPROGRESS";
 
-  toEpoll(fd_event, tirpc::IOEvent::WRITE);
-
-  bool is_timeout = false;  // 是否超时
+  // 是否超时，定时器在协程挂起时写入，不能放在可能是共享栈的协程栈上
+  auto is_timeout = std::make_shared<bool>(false);
 
   // 超时函数句柄
-  auto timeout_cb = [&is_timeout, cur_cor]() {
+  auto timeout_cb = [is_timeout, cur_cor]() {
     // 设置超时标志，然后唤醒协程
-    is_timeout = true;
+    *is_timeout = true;
     tirpc::Coroutine::Resume(cur_cor);
   };
 
@@ -292,12 +413,22 @@ int connect_hook(int sockfd, const struct sockaddr *addr, socklen_t addrlen) {
   tirpc::Timer *timer = reactor->GetTimer();
   timer->AddTimerEvent(event);
 
-  tirpc::Coroutine::Yield();
+  bool polled = false;
+#ifdef TIRPC_HAS_IO_URING
+  tirpc::IoUring *ring = GetIoUringOfCurrentCoroutine();
+  int revents = 0;
+  polled = ring != nullptr && ring->Poll(sockfd, POLLOUT, &revents);
+#endif
+  if (!polled) {
+    toEpoll(fd_event, tirpc::IOEvent::WRITE);
 
-  // write事件需要删除，因为连接成功后后面会重新监听该fd的写事件。
-  fd_event->DelListenEvents(tirpc::IOEvent::WRITE);
-  fd_event->ClearCoroutine();
-  // fd_event->updateToReactor();
+    tirpc::Coroutine::Yield();
+
+    // write事件需要删除，因为连接成功后后面会重新监听该fd的写事件。
+    fd_event->DelListenEvents(tirpc::IOEvent::WRITE);
+    fd_event->ClearCoroutine();
+    // fd_event->updateToReactor();
+  }
 
   // 定时器也需要删除
   timer->DelTimerEvent(event);
@@ -308,7 +439,7 @@ int connect_hook(int sockfd, const struct sockaddr *addr, socklen_t addrlen) {
     return 0;
   }
 
-  if (is_timeout) {
+  if (*is_timeout) {
     LOG_ERROR << "connect error,  timeout[ " << g_max_connect_timeout->GetValue() << "ms]";
     errno = ETIMEDOUT;
   }
@@ -326,10 +457,11 @@ unsigned int sleep_hook(unsigned int seconds) {
 
   tirpc::Coroutine *cur_cor = tirpc::Coroutine::GetCurrentCoroutine();
 
-  bool is_timeout = false;
-  auto timeout_cb = [cur_cor, &is_timeout]() {
+  // written by timer while this coroutine yields, keep it off the stack which may be shared
+  auto is_timeout = std::make_shared<bool>(false);
+  auto timeout_cb = [cur_cor, is_timeout]() {
     LOG_DEBUG << "onTime, now resume sleep cor";
-    is_timeout = true;
+    *is_timeout = true;
     // 设置超时标志，然后唤醒协程
     tirpc::Coroutine::Resume(cur_cor);
   };
@@ -341,7 +473,7 @@ unsigned int sleep_hook(unsigned int seconds) {
   LOG_DEBUG << "now to yield sleep";
   // beacuse read or wirte maybe resume this coroutine, so when this cor be resumed, must check is timeout, otherwise
   // should yield again
-  while (!is_timeout) {
+  while (!*is_timeout) {
     tirpc::Coroutine::Yield();
   }
 
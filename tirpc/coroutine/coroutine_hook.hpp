@@ -28,6 +28,13 @@ ssize_t recv_hook(int fd, void *buf, size_t count, int flag);
 
 ssize_t send_hook(int fd, const void *buf, size_t count, int flag);
 
+// wait until fd is writable without holding any buffer, caller takes data to send again after it returns
+void wait_writable_hook(int fd);
+
+// wait until one of events is ready, other coroutines may add events to fd while it waits, always waits on epoll
+// returns ready events, 0 if it's resumed by timer
+int wait_events_hook(int fd, int events);
+
 ssize_t read_hook(int fd, void *buf, size_t count);
 
 ssize_t write_hook(int fd, const void *buf, size_t count);
@@ -1,19 +1,31 @@
 #include "tirpc/coroutine/coroutine_pool.hpp"
 
 #include <sys/mman.h>
+#include <algorithm>
 #include <vector>
 
 #include "tirpc/common/config.hpp"
 #include "tirpc/common/log.hpp"
-#include "tirpc/common/mutex.hpp"
 #include "tirpc/coroutine/coroutine.hpp"
 
 namespace tirpc {
 
-static ConfigVar<int>::ptr g_cor_stack_size = Config::Lookup("coroutine.stack_size", 256);
-static ConfigVar<int>::ptr g_cor_pool_size = Config::Lookup("coroutine.pool_size", 1000);
+static ConfigVar<int>::ptr g_cor_stack_size = Config::Lookup("coroutine.stack_size", 256, "coroutine stack size, KB");
+static ConfigVar<int>::ptr g_cor_pool_size =
+    Config::Lookup("coroutine.pool_size", 1000, "coroutine count of pool of each thread, pool grows by it");
+static ConfigVar<bool>::ptr g_cor_guard_page =
+    Config::Lookup("coroutine.guard_page", true, "protect a guard page under every coroutine stack");
+static ConfigVar<int>::ptr g_cor_hot_stacks = Config::Lookup(
+    "coroutine.hot_stacks", -1, "free stacks kept committed, older ones are trimmed by MADV_DONTNEED. -1 means never");
 
-static CoroutinePool *t_coroutine_container_ptr = nullptr;
+static ConfigVar<int>::ptr g_cor_shared_stacks =
+    Config::Lookup("coroutine.shared_stacks", 0,
+                   "shared stacks of each thread which server connection coroutines run on in turn, frames of yielded "
+                   "ones are copied out. 0 means every connection has its own stack");
+
+static thread_local CoroutinePool *t_coroutine_container_ptr = nullptr;
+
+static thread_local CoroutinePool *t_shared_stack_pool_ptr = nullptr;
 
 auto GetCoroutinePool() -> CoroutinePool * {
   if (t_coroutine_container_ptr == nullptr) {
@@ -23,63 +35,169 @@ auto GetCoroutinePool() -> CoroutinePool * {
   return t_coroutine_container_ptr;
 }
 
-CoroutinePool::CoroutinePool(int pool_size, int stack_size /*= 1024 * 128 B*/)
-    : pool_size_(pool_size), stack_size_(stack_size) {
+auto GetConnectionCoroutinePool() -> CoroutinePool * {
+  if (g_cor_shared_stacks->GetValue() <= 0) {
+    return GetCoroutinePool();
+  }
+  if (t_shared_stack_pool_ptr == nullptr) {
+    LOG_INFO << "Fetch " << g_cor_shared_stacks->GetName() << ": " << g_cor_shared_stacks->GetValue();
+    t_shared_stack_pool_ptr = new CoroutinePool(g_cor_pool_size->GetValue(), g_cor_stack_size->GetValue() * 1024,
+                                                g_cor_shared_stacks->GetValue());
+  }
+  return t_shared_stack_pool_ptr;
+}
+
+CoroutinePool::CoroutinePool(int pool_size, int stack_size /*= 1024 * 128 B*/, int shared_stacks /*= 0*/)
+    : pool_size_(std::max(pool_size, 1)),
+      stack_size_(stack_size),
+      owner_tid_(GetTid()),
+      guard_page_(g_cor_guard_page->GetValue()),
+      hot_stacks_(g_cor_hot_stacks->GetValue()) {
   // set main coroutine first
   Coroutine::GetCurrentCoroutine();
 
-  memory_pool_.push_back(std::make_shared<Memory>(stack_size_, pool_size_));
+  if (shared_stacks > 0) {
+    shared_stack_memory_ = std::make_shared<Memory>(stack_size_, shared_stacks, guard_page_);
+    shared_stacks_.resize(shared_stacks);
+    for (auto &stack : shared_stacks_) {
+      stack.stack_sp_ = shared_stack_memory_->GetBlock();
+      stack.stack_size_ = stack_size_;
+      stack.owner_tid_ = owner_tid_;
+    }
+  }
 
-  Memory::ptr tmp = memory_pool_[0];
+  Expand();
+}
 
+CoroutinePool::~CoroutinePool() {
+  while (ReturnNode *node = return_queue_.Pop()) {
+    delete node;
+  }
+}
+
+void CoroutinePool::Expand() {
+  Memory::ptr memory;
+  if (shared_stacks_.empty()) {
+    memory = std::make_shared<Memory>(stack_size_, pool_size_, guard_page_);
+    memory_pool_.push_back(memory);
+  }
+
+  int base = static_cast<int>(cors_.size());
   for (int i = 0; i < pool_size_; ++i) {
-    Coroutine::ptr cor = std::make_shared<Coroutine>(stack_size_, tmp->GetBlock());
-    cor->SetIndex(i);
-    free_cors_.emplace_back(cor, false);
+    Coroutine::ptr cor =
+        memory != nullptr ? std::make_shared<Coroutine>(stack_size_, memory->GetBlock())
+                          : std::make_shared<Coroutine>(&shared_stacks_[(base + i) % shared_stacks_.size()]);
+    cor->SetIndex(base + i);
+    cor->SetPool(this);
+    cors_.push_back(cor);
+    is_free_.push_back(true);
+    is_trimmed_.push_back(true);
+  }
+  // lower index is popped first
+  for (int i = pool_size_ - 1; i >= 0; --i) {
+    free_cors_.push_back(base + i);
+  }
+  LOG_INFO << "coroutine pool expands to " << cors_.size() << " coroutines";
+}
+
+void CoroutinePool::CheckBusyCoroutine() {
+  if (busy_cors_.empty()) {
+    return;
+  }
+  busy_cursor_ %= busy_cors_.size();
+  int i = busy_cors_[busy_cursor_];
+  // is_running_ is released after it yields, so is_in_cofunc_ written before is visible
+  if (!cors_[i]->IsRunning() && !cors_[i]->GetIsInCoFunc()) {
+    busy_cors_[busy_cursor_] = busy_cors_.back();
+    busy_cors_.pop_back();
+    free_cors_.push_back(i);
+  } else {
+    ++busy_cursor_;
   }
 }
 
-CoroutinePool::~CoroutinePool() = default;
+void CoroutinePool::HandleReturnedCoroutines() {
+  while (ReturnNode *node = return_queue_.Pop()) {
+    ReturnInOwnerThread(node->cor_);
+    delete node;
+  }
+}
 
 auto CoroutinePool::GetCoroutineInstanse() -> Coroutine::ptr {
-  // from 0 to find first free coroutine which: 1. it.second = false, 2. getIsInCoFunc() is false
   // try our best to reuse used corroutine, and try our best not to choose unused coroutine
   // beacuse used couroutine which used has already write bytes into physical memory,
   // but unused coroutine no physical memory yet. we just call mmap get virtual address, but not write yet.
-  // so linux will alloc physical when we realy write, that casuse page fault interrupt
-
-  Mutex::Locker lock(mutex_);
-  for (int i = 0; i < pool_size_; ++i) {
-    if (!free_cors_[i].first->GetIsInCoFunc() && !free_cors_[i].second) {
-      free_cors_[i].second = true;
-      Coroutine::ptr cor = free_cors_[i].first;
-      lock.Unlock();
-      return cor;
+  // so linux will alloc physical when we realy write, that casuse page fault interrupt.
+  // free_cors_ is a stack, the latest returned one is on the top
+
+  // one busy coroutine per call, so the cost is O(1) even if some are never finished
+  CheckBusyCoroutine();
+  while (true) {
+    if (free_cors_.empty()) {
+      HandleReturnedCoroutines();
+      if (free_cors_.empty()) {
+        Expand();
+      }
     }
-  }
-
-  for (size_t i = 1; i < memory_pool_.size(); ++i) {
-    char *tmp = memory_pool_[i]->GetBlock();
-    if (tmp != nullptr) {
-      Coroutine::ptr cor = std::make_shared<Coroutine>(stack_size_, tmp);
-      return cor;
+    int i = free_cors_.back();
+    free_cors_.pop_back();
+    const Coroutine::ptr &cor = cors_[i];
+    if (cor->IsRunning() || cor->GetIsInCoFunc()) {
+      busy_cors_.push_back(i);
+      continue;
     }
+    is_free_[i] = false;
+    is_trimmed_[i] = false;
+    return cor;
   }
-  memory_pool_.push_back(std::make_shared<Memory>(stack_size_, pool_size_));
-  return std::make_shared<Coroutine>(stack_size_, memory_pool_[memory_pool_.size() - 1]->GetBlock());
 }
 
 void CoroutinePool::ReturnCoroutine(Coroutine::ptr cor) {
+  if (cor == nullptr || cor->GetPool() == nullptr) {
+    return;
+  }
+  CoroutinePool *pool = cor->GetPool();
+  if (pool->owner_tid_ == GetTid()) {
+    pool->ReturnInOwnerThread(cor);
+    return;
+  }
+  // e.g. it's stolen by another io thread and released there
+  auto *node = new ReturnNode();
+  node->cor_ = std::move(cor);
+  pool->return_queue_.Push(node);
+}
+
+void CoroutinePool::ReturnInOwnerThread(const Coroutine::ptr &cor) {
   int i = cor->GetIndex();
-  if (i >= 0 && i < pool_size_) {
-    free_cors_[i].second = false;
-  } else {
-    for (size_t i = 1; i < memory_pool_.size(); ++i) {
-      if (memory_pool_[i]->HasBlock(cor->GetStackPtr())) {
-        memory_pool_[i]->BackBlock(cor->GetStackPtr());
-      }
+  if (i < 0 || i >= static_cast<int>(cors_.size()) || cors_[i] != cor || is_free_[i]) {
+    // returned twice
+    return;
+  }
+  is_free_[i] = true;
+  free_cors_.push_back(i);
+  if (!shared_stacks_.empty()) {
+    if (!cor->IsRunning() && !cor->GetIsInCoFunc()) {
+      // nobody resumes it again, drop its copied frames now instead of when it's reused
+      cor->ReleaseSavedStack();
     }
+    return;
+  }
+  TrimColdStack();
+}
+
+void CoroutinePool::TrimColdStack() {
+  if (hot_stacks_ < 0 || free_cors_.size() <= static_cast<size_t>(hot_stacks_)) {
+    return;
+  }
+  // free_cors_ is a stack, this one has just been pushed out of the latest returned hot_stacks_ ones
+  int i = free_cors_[free_cors_.size() - 1 - hot_stacks_];
+  const Coroutine::ptr &cor = cors_[i];
+  if (is_trimmed_[i] || cor->IsRunning() || cor->GetIsInCoFunc()) {
+    // the function hasn't finished, its stack is still in use
+    return;
   }
+  memory_pool_[i / pool_size_]->Trim(cor->GetStackPtr());
+  is_trimmed_[i] = true;
 }
 
 }  // namespace tirpc
\ No newline at end of file
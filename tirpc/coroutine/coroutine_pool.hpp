@@ -1,38 +1,112 @@
 #pragma once
 
+#include <sys/types.h>
+#include <atomic>
 #include <vector>
 
-#include "tirpc/common/mutex.hpp"
+#include "tirpc/common/mpsc_queue.hpp"
 #include "tirpc/coroutine/coroutine.hpp"
 #include "tirpc/coroutine/memory.hpp"
 
 namespace tirpc {
 
+/**
+ * @brief 协程池，每个线程一个，只有所属线程从中获取协程，不加锁
+ * 协程按下标管理，归还的协程下标放入栈式空闲链表，获取和归还都是 O(1)，协程用完时按 pool_size 整块扩容。
+ * 其他线程归还的协程（比如被窃取到其他 IO 线程上结束的）放入无锁队列，由所属线程在获取时合并。
+ * 开启 coroutine.hot_stacks 时，空闲链表中最近归还的 hot_stacks 个以外的栈被 MADV_DONTNEED 释放物理内存。
+ * shared_stacks 大于 0 时是共享栈协程池，协程不再独占栈，而是轮流在 shared_stacks 个共享栈上运行，
+ * 让出后只保存实际用到的栈，适合大量空闲的长连接。共享栈上的协程只能由所属线程恢复，不能被其他 IO 线程窃取
+ */
 class CoroutinePool {
  public:
-  explicit CoroutinePool(int pool_size, int stack_size = 1024 * 128);
+  explicit CoroutinePool(int pool_size, int stack_size = 1024 * 128, int shared_stacks = 0);
 
   ~CoroutinePool();
 
+  /**
+   * @brief 获取一个协程，只能由所属线程调用
+   */
   auto GetCoroutineInstanse() -> Coroutine::ptr;
 
+  /**
+   * @brief 把协程归还到它所属的协程池，可以在任意线程调用
+   */
   void ReturnCoroutine(Coroutine::ptr cor);
 
+ private:
+  /**
+   * @brief 其他线程的一次归还
+   */
+  struct ReturnNode {
+    std::atomic<ReturnNode *> next_{nullptr};
+    Coroutine::ptr cor_;
+  };
+
+  /**
+   * @brief 申请一块能放 pool_size_ 个协程栈的内存，并创建这些协程放入空闲链表
+   */
+  void Expand();
+
+  /**
+   * @brief 检查一个函数还没执行完就被归还的协程，执行完了就放回空闲链表
+   */
+  void CheckBusyCoroutine();
+
+  /**
+   * @brief 把其他线程归还的协程放回空闲链表
+   */
+  void HandleReturnedCoroutines();
+
+  void ReturnInOwnerThread(const Coroutine::ptr &cor);
+
+  /**
+   * @brief 释放刚刚离开热区的空闲栈的物理内存，每次归还最多一个
+   */
+  void TrimColdStack();
+
  private:
   int pool_size_{0};
   int stack_size_{0};
+  pid_t owner_tid_{0};  // thread gets coroutines from it
+  bool guard_page_{true};
+  int hot_stacks_{-1};  // free stacks kept committed, -1 means never trim
 
-  // first--ptr of cor
-  // second
-  //    false -- can be dispatched
-  //    true -- can't be dispatched
-  std::vector<std::pair<Coroutine::ptr, bool>> free_cors_;
+  // all coroutines, index of coroutine in it is cor->GetIndex()
+  std::vector<Coroutine::ptr> cors_;
 
-  Mutex mutex_;
+  // true when coroutine is returned, in free_cors_ or busy_cors_
+  std::vector<bool> is_free_;
+
+  // true when stack has no physical pages, never used or trimmed
+  std::vector<bool> is_trimmed_;
+
+  // index of returned coroutines, the latest returned one is reused first
+  std::vector<int> free_cors_;
+
+  // index of coroutines returned before their function finished, they can't be reset by SetCallBack yet
+  std::vector<int> busy_cors_;
+  size_t busy_cursor_{0};
+
+  // coroutines returned by other threads
+  MpscQueue<ReturnNode> return_queue_;
 
   std::vector<Memory::ptr> memory_pool_;
+
+  // run stacks of shared stack pool, coroutines are bound to them in turn. it's never resized
+  std::vector<SharedStack> shared_stacks_;
+  Memory::ptr shared_stack_memory_;
 };
 
+/**
+ * @brief 当前线程的协程池，第一次调用时创建
+ */
 auto GetCoroutinePool() -> CoroutinePool *;
 
-}  // namespace tirpc
\ No newline at end of file
+/**
+ * @brief 当前线程中服务端连接 loop 协程使用的协程池，开启 coroutine.shared_stacks 时是共享栈协程池，
+ * 否则就是 GetCoroutinePool()
+ */
+auto GetConnectionCoroutinePool() -> CoroutinePool *;
+
+}  // namespace tirpc
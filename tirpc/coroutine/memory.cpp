@@ -1,6 +1,11 @@
 #include "tirpc/coroutine/memory.hpp"
 
+#include <sys/mman.h>
+#include <unistd.h>
 #include <cassert>
+#include <cerrno>
+#include <cstring>
+#include <fstream>
 
 #include "tirpc/common/config.hpp"
 #include "tirpc/common/log.hpp"
@@ -9,19 +14,63 @@ namespace tirpc {
 
 static ConfigVar<bool>::ptr g_use_lock_free = Config::Lookup("use_lock_free", false, "wheather to use lock free queue");
 
-Memory::Memory(int block_size, int block_count) : block_size_(block_size), block_count_(block_count) {
-  size_ = block_size_ * block_count_;
-  start_ = static_cast<char *>(malloc(size_));
+// guard pages protected by all Memory of this process
+static std::atomic<int64_t> g_guard_pages{0};
+
+/**
+ * @brief 保护页数量的上限。每个保护页把映射多切出两个 vma，受 vm.max_map_count 限制，
+ * 这里最多用掉一半，剩下的留给 malloc、线程栈等其他 mmap
+ */
+static auto GetGuardPageLimit() -> int64_t {
+  static int64_t limit = []() {
+    int64_t max_map_count = 65530;
+    std::ifstream in("/proc/sys/vm/max_map_count");
+    in >> max_map_count;
+    return max_map_count / 4;
+  }();
+  return limit;
+}
 
-  assert(start_ != nullptr);
+Memory::Memory(int block_size, int block_count, bool guard_page /*= true*/)
+    : block_size_(block_size), block_count_(block_count) {
+  auto page_size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+  if (guard_page) {
+    if (g_guard_pages.fetch_add(block_count_) + block_count_ <= GetGuardPageLimit()) {
+      guard_size_ = page_size;
+    } else {
+      g_guard_pages.fetch_sub(block_count_);
+      LOG_WARN << "guard pages exceed limit " << GetGuardPageLimit() << " of vm.max_map_count, " << block_count_
+               << " blocks have no guard page";
+    }
+  }
+  // blocks are page aligned, so that guard pages can be protected
+  block_stride_ = (static_cast<size_t>(block_size_) + page_size - 1) / page_size * page_size + guard_size_;
+  size_ = block_stride_ * block_count_;
+
+  // only address space is reserved, pages are committed when stacks touch them
+  void *addr = mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (addr == MAP_FAILED) {
+    LOG_ERROR << "mmap " << size_ << " bytes error, sys errinfo = " << strerror(errno);
+    Exit(0);
+  }
+  start_ = static_cast<char *>(addr);
   LOG_DEBUG << "succ mmap " << size_ << " bytes memory";
 
   end_ = start_ + size_ - 1;
 
-  blocks_.resize(block_count_);
+  // stack grows down, guard page is at the bottom of every block
+  for (int i = 0; i < block_count_ && guard_size_ > 0; ++i) {
+    if (mprotect(start_ + i * block_stride_, guard_size_, PROT_NONE) != 0) {
+      LOG_WARN << "protect guard page error, blocks from [" << i
+               << "] have no guard page, sys errinfo = " << strerror(errno);
+      break;
+    }
+  }
 
-  for (size_t i = 0; i < blocks_.size(); ++i) {
-    blocks_[i] = false;
+  // block 0 is popped first
+  free_blocks_.reserve(block_count_);
+  for (int i = block_count_ - 1; i >= 0; --i) {
+    free_blocks_.push_back(i);
   }
 
   ref_count_ = 0;
@@ -31,7 +80,10 @@ Memory::~Memory() {
   if (start_ == nullptr) {
     return;
   }
-  free(start_);
+  munmap(start_, size_);
+  if (guard_size_ > 0) {
+    g_guard_pages.fetch_sub(block_count_);
+  }
   LOG_INFO << "~succ free mumap " << size_ << " bytes memory";
   start_ = nullptr;
   ref_count_ = 0;
@@ -44,21 +96,15 @@ auto Memory::GetStart() -> char * { return start_; }
 auto Memory::GetEnd() -> char * { return end_; }
 
 auto Memory::GetBlock() -> char * {
-  int t = -1;
   Mutex::Locker lock(mutex_);
-  for (size_t i = 0; i < blocks_.size(); ++i) {
-    if (!blocks_[i]) {
-      blocks_[i] = true;
-      t = i;
-      break;
-    }
-  }
-  lock.Unlock();
-  if (t == -1) {
+  if (free_blocks_.empty()) {
     return nullptr;
   }
+  int t = free_blocks_.back();
+  free_blocks_.pop_back();
+  lock.Unlock();
   ref_count_++;
-  return start_ + (t * block_size_);
+  return start_ + t * block_stride_ + guard_size_;
 }
 
 void Memory::BackBlock(char *block) {
@@ -67,9 +113,9 @@ void Memory::BackBlock(char *block) {
     return;
   }
 
-  int t = (block - start_) / block_size_;
+  int t = static_cast<int>((block - start_) / block_stride_);
   Mutex::Locker lock(mutex_);
-  blocks_[t] = false;
+  free_blocks_.push_back(t);
   lock.Unlock();
 
   ref_count_--;
@@ -77,4 +123,10 @@ void Memory::BackBlock(char *block) {
 
 auto Memory::HasBlock(char *block) -> bool { return ((block >= start_) && (block <= end_)); }
 
+void Memory::Trim(char *block) {
+  if (madvise(block, block_stride_ - guard_size_, MADV_DONTNEED) != 0) {
+    LOG_ERROR << "madvise MADV_DONTNEED error, sys errinfo = " << strerror(errno);
+  }
+}
+
 }  // namespace tirpc
\ No newline at end of file
@@ -8,11 +8,17 @@
 
 namespace tirpc {
 
+/**
+ * @brief 一块连续内存，切分成大小相同的 block 作为协程栈
+ * 内存由 mmap(MAP_NORESERVE) 保留，栈被写到的页才分配物理内存；每个 block 下方有一个 PROT_NONE 的保护页，
+ * 栈溢出时立即触发段错误，而不是写坏相邻的栈。保护页总数受 vm.max_map_count 限制，超出后新的 Memory 不再加保护页。
+ * 空闲 block 的下标保存在栈式空闲链表中，GetBlock 和 BackBlock 都是 O(1)，并且优先复用最近归还的 block
+ */
 class Memory {
  public:
   using ptr = std::shared_ptr<Memory>;
 
-  Memory(int block_size, int block_count);
+  Memory(int block_size, int block_count, bool guard_page = true);
 
   ~Memory();
 
@@ -28,16 +34,25 @@ class Memory {
 
   auto HasBlock(char *block) -> bool;
 
+  /**
+   * @brief 释放 block 已分配的物理内存，地址仍然保留，再次写入时重新分配清零的页
+   */
+  void Trim(char *block);
+
  private:
   int block_size_{0};
   int block_count_{0};
 
-  int size_{0};
+  size_t guard_size_{0};   // size of guard page under every block, 0 if guard page is off
+  size_t block_stride_{0};  // distance between two blocks, page aligned block size + guard_size_
+
+  size_t size_{0};
   char *start_{nullptr};
   char *end_{nullptr};
 
   std::atomic<int> ref_count_{0};
-  std::vector<bool> blocks_;
+  // index of free blocks, not linked in blocks themselves so that untouched stacks don't get physical pages
+  std::vector<int> free_blocks_;
 
   Mutex mutex_;
 };
@@ -1,15 +1,22 @@
 #pragma once
 
 #include <arpa/inet.h>
+#include <endian.h>
 #include <cstdint>
 #include <cstring>
 
 namespace tirpc {
 
-auto GetInt32FromNetByte(const char *buf) -> int32_t {
+inline auto GetInt32FromNetByte(const char *buf) -> int32_t {
   int32_t tmp;
   memcpy(&tmp, buf, sizeof(tmp));
   return ntohl(tmp);
 }
 
+inline auto GetInt64FromNetByte(const char *buf) -> uint64_t {
+  uint64_t tmp;
+  memcpy(&tmp, buf, sizeof(tmp));
+  return be64toh(tmp);
+}
+
 }  // namespace tirpc
\ No newline at end of file
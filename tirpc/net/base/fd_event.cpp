@@ -3,6 +3,7 @@
 #include <fcntl.h>
 #include <sys/epoll.h>
 
+#include "tirpc/common/config.hpp"
 #include "tirpc/common/log.hpp"
 #include "tirpc/common/mutex.hpp"
 #include "tirpc/net/base/reactor.hpp"
@@ -11,6 +12,9 @@ namespace tirpc {
 
 static FdEventContainer *g_fd_container = nullptr;
 
+static ConfigVar<bool>::ptr g_use_epoll_oneshot = Config::Lookup(
+    "use_epoll_oneshot", true, "whether fd waited by coroutine keeps registered on epoll with EPOLLONESHOT");
+
 FdEvent::FdEvent(Reactor *reactor, int fd) : fd_(fd), reactor_(reactor) {
   if (reactor == nullptr) {
     LOG_ERROR << "create reactor first";
@@ -55,7 +59,8 @@ auto FdEvent::GetCallBack(IOEvent flag) const -> std::function<void()> {
 }
 
 void FdEvent::AddListenEvents(IOEvent event) {
-  if (listen_events_ & event) {
+  // oneshot registration may has been disarmed by kernel, always arm it again
+  if ((listen_events_ & event) && !one_shot_) {
     LOG_DEBUG << "already has this event, skip";
     return;
   }
@@ -67,6 +72,11 @@ void FdEvent::DelListenEvents(IOEvent event) {
   if ((listen_events_ & event) != 0U) {
     LOG_DEBUG << "delete succ";
     listen_events_ &= ~event;
+    if (one_shot_) {
+      // kernel stop listening after the event occur, keep fd on epoll and arm it when wait next time.
+      // if coroutine is resumed by timer, the stale event will be ignored since no coroutine wait it
+      return;
+    }
     UpdateToReactor();
     return;
   }
@@ -74,8 +84,11 @@ void FdEvent::DelListenEvents(IOEvent event) {
 }
 
 void FdEvent::UpdateToReactor() {
+  // only coroutine waits fd by hook, it's resumed once for every wait
+  one_shot_ = cor_ != nullptr && listen_events_ != 0 && g_use_epoll_oneshot->GetValue();
+
   epoll_event event;
-  event.events = listen_events_;
+  event.events = listen_events_ | (one_shot_ ? EPOLLONESHOT : 0);
   event.data.ptr = this;
 
   if (reactor_ == nullptr) {
@@ -90,10 +103,19 @@ void FdEvent::UnregisterFromReactor() {
   }
   reactor_->DelEvent(fd_);
   listen_events_ = 0;
+  one_shot_ = false;
   read_callback_ = nullptr;
   write_callback_ = nullptr;
 }
 
+void FdEvent::MoveToReactor(Reactor *reactor) {
+  if (one_shot_ && reactor_ != nullptr && reactor_ != reactor) {
+    // disarmed but still on old epoll, one fd must not be registered in two of them
+    reactor_->DelStolenEvent(fd_);
+  }
+  reactor_ = reactor;
+}
+
 auto FdEvent::GetFd() const -> int { return fd_; }
 
 void FdEvent::SetFd(int fd) { fd_ = fd; }
@@ -38,6 +38,11 @@ class FdEvent : public std::enable_shared_from_this<FdEvent> {
 
   void UnregisterFromReactor();
 
+  /**
+   * @brief 协程被其他 IO 线程偷走时调用，把仍留在原 reactor 上的 EPOLLONESHOT 注册删除，之后在新 reactor 上注册
+   */
+  void MoveToReactor(Reactor *reactor);
+
   auto GetFd() const -> int;
 
   void SetFd(int fd);
@@ -58,6 +63,11 @@ class FdEvent : public std::enable_shared_from_this<FdEvent> {
 
   void ClearCoroutine();
 
+  /**
+   * @brief fd 以 EPOLLONESHOT 注册在 reactor 上，事件触发后内核已自动停止监听，不需要再从 epoll 中删除
+   */
+  auto IsOneShot() const -> bool { return one_shot_; }
+
  public:
   Mutex mutex_;
 
@@ -72,6 +82,8 @@ class FdEvent : public std::enable_shared_from_this<FdEvent> {
   Reactor *reactor_{nullptr};
 
   Coroutine *cor_{nullptr};
+
+  bool one_shot_{false};
 };
 
 class FdEventContainer {
@@ -0,0 +1,399 @@
+#ifdef TIRPC_HAS_IO_URING
+
+#include "tirpc/net/base/io_uring.hpp"
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+#include "tirpc/common/log.hpp"
+#include "tirpc/coroutine/coroutine.hpp"
+#include "tirpc/net/base/reactor.hpp"
+
+#ifndef IORING_SQ_CQ_OVERFLOW
+#define IORING_SQ_CQ_OVERFLOW (1U << 1)  // since linux 5.14, older kernels never set it
+#endif
+
+namespace tirpc {
+
+static auto IoUringSetup(unsigned entries, io_uring_params *p) -> int {
+  return static_cast<int>(syscall(__NR_io_uring_setup, entries, p));
+}
+
+static auto IoUringEnter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) -> int {
+  return static_cast<int>(syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, nullptr, 0));
+}
+
+auto IoUring::Create(unsigned entries) -> std::unique_ptr<IoUring> {
+  io_uring_params p;
+  memset(&p, 0, sizeof(p));
+  int fd = IoUringSetup(entries, &p);
+  if (fd < 0) {
+    LOG_ERROR << "io_uring_setup error, sys error=" << strerror(errno);
+    return nullptr;
+  }
+  std::unique_ptr<IoUring> ring(new IoUring());
+  ring->ring_fd_ = fd;
+
+  // recv/send on non-blocking sockets are only poll-armed by kernel since fast poll
+  if ((p.features & IORING_FEAT_FAST_POLL) == 0) {
+    LOG_ERROR << "io_uring of this kernel doesn't support fast poll";
+    return nullptr;
+  }
+
+  ring->sq_ring_size_ = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  ring->cq_ring_size_ = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+  bool single_mmap = (p.features & IORING_FEAT_SINGLE_MMAP) != 0;
+  if (single_mmap) {
+    ring->sq_ring_size_ = std::max(ring->sq_ring_size_, ring->cq_ring_size_);
+    ring->cq_ring_size_ = ring->sq_ring_size_;
+  }
+  ring->sq_ring_ =
+      mmap(nullptr, ring->sq_ring_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+  if (ring->sq_ring_ == MAP_FAILED) {
+    ring->sq_ring_ = nullptr;
+    LOG_ERROR << "mmap io_uring sq ring error, sys error=" << strerror(errno);
+    return nullptr;
+  }
+  if (single_mmap) {
+    ring->cq_ring_ = ring->sq_ring_;
+  } else {
+    ring->cq_ring_ =
+        mmap(nullptr, ring->cq_ring_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+    if (ring->cq_ring_ == MAP_FAILED) {
+      ring->cq_ring_ = nullptr;
+      LOG_ERROR << "mmap io_uring cq ring error, sys error=" << strerror(errno);
+      return nullptr;
+    }
+  }
+  void *sqes = mmap(nullptr, p.sq_entries * sizeof(io_uring_sqe), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                    fd, IORING_OFF_SQES);
+  if (sqes == MAP_FAILED) {
+    LOG_ERROR << "mmap io_uring sqes error, sys error=" << strerror(errno);
+    return nullptr;
+  }
+  ring->sqes_ = static_cast<io_uring_sqe *>(sqes);
+  ring->sq_entries_ = p.sq_entries;
+
+  char *sq = static_cast<char *>(ring->sq_ring_);
+  ring->sq_head_ = reinterpret_cast<unsigned *>(sq + p.sq_off.head);
+  ring->sq_tail_ = reinterpret_cast<unsigned *>(sq + p.sq_off.tail);
+  ring->sq_flags_ = reinterpret_cast<unsigned *>(sq + p.sq_off.flags);
+  ring->sq_mask_ = *reinterpret_cast<unsigned *>(sq + p.sq_off.ring_mask);
+  char *cq = static_cast<char *>(ring->cq_ring_);
+  ring->cq_head_ = reinterpret_cast<unsigned *>(cq + p.cq_off.head);
+  ring->cq_tail_ = reinterpret_cast<unsigned *>(cq + p.cq_off.tail);
+  ring->cq_mask_ = *reinterpret_cast<unsigned *>(cq + p.cq_off.ring_mask);
+  ring->cqes_ = reinterpret_cast<io_uring_cqe *>(cq + p.cq_off.cqes);
+
+  // sqes are always used in order, so map sq array one to one once
+  auto *array = reinterpret_cast<unsigned *>(sq + p.sq_off.array);
+  for (unsigned i = 0; i < p.sq_entries; ++i) {
+    array[i] = i;
+  }
+  ring->sqe_tail_ = *ring->sq_tail_;
+
+  LOG_DEBUG << "succ create io_uring, fd = " << fd << ", sq entries = " << p.sq_entries
+            << ", cq entries = " << p.cq_entries;
+  return ring;
+}
+
+IoUring::~IoUring() {
+  if (sqes_ != nullptr) {
+    munmap(sqes_, sq_entries_ * sizeof(io_uring_sqe));
+  }
+  if (cq_ring_ != nullptr && cq_ring_ != sq_ring_) {
+    munmap(cq_ring_, cq_ring_size_);
+  }
+  if (sq_ring_ != nullptr) {
+    munmap(sq_ring_, sq_ring_size_);
+  }
+  if (ring_fd_ >= 0) {
+    close(ring_fd_);
+  }
+}
+
+auto IoUring::GetSqe() -> io_uring_sqe * {
+  unsigned head = __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+  if (sqe_tail_ - head >= sq_entries_) {
+    // sq is full, let kernel consume it now
+    Submit();
+    head = __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+    if (sqe_tail_ - head >= sq_entries_) {
+      return nullptr;
+    }
+  }
+  io_uring_sqe *sqe = &sqes_[sqe_tail_ & sq_mask_];
+  memset(sqe, 0, sizeof(*sqe));
+  ++sqe_tail_;
+  return sqe;
+}
+
+void IoUring::Submit() {
+  unsigned tail = *sq_tail_;
+  if (tail != sqe_tail_) {
+    to_submit_ += sqe_tail_ - tail;
+    __atomic_store_n(sq_tail_, sqe_tail_, __ATOMIC_RELEASE);
+  }
+  // flush overflowed cqes too, otherwise ring fd won't be readable in epoll_wait
+  unsigned flags = IsCqOverflow() ? IORING_ENTER_GETEVENTS : 0;
+  if (to_submit_ == 0 && flags == 0) {
+    return;
+  }
+  int rt = IoUringEnter(ring_fd_, to_submit_, 0, flags);
+  if (rt < 0) {
+    // EAGAIN/EBUSY: kernel is short of resources or cq is overflowed, submit them next loop
+    if (errno != EAGAIN && errno != EBUSY && errno != EINTR) {
+      LOG_ERROR << "io_uring_enter error, sys error=" << strerror(errno);
+    }
+    return;
+  }
+  to_submit_ -= std::min(static_cast<unsigned>(rt), to_submit_);
+}
+
+auto IoUring::IsCqOverflow() const -> bool {
+  return (__atomic_load_n(sq_flags_, __ATOMIC_ACQUIRE) & IORING_SQ_CQ_OVERFLOW) != 0;
+}
+
+void IoUring::Reap() {
+  struct Completion {
+    IoUringOp *op_;
+    int32_t res_;
+    uint32_t flags_;
+  };
+  std::vector<Completion> completions;
+  unsigned head = *cq_head_;
+  while (true) {
+    unsigned tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+    if (head == tail) {
+      break;
+    }
+    for (; head != tail; ++head) {
+      io_uring_cqe *cqe = &cqes_[head & cq_mask_];
+      // user_data 0 is the cqe of cancel request, nobody waits for it
+      if (cqe->user_data != 0) {
+        completions.push_back({reinterpret_cast<IoUringOp *>(cqe->user_data), cqe->res, cqe->flags});
+      }
+    }
+    // give cq entries back before callbacks, resumed coroutines may submit and complete more
+    __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+    if (IsCqOverflow()) {
+      IoUringEnter(ring_fd_, 0, 0, IORING_ENTER_GETEVENTS);
+    }
+  }
+  for (auto &c : completions) {
+    c.op_->on_complete_(c.op_, c.res_, c.flags_);
+  }
+}
+
+void IoUring::OnOpComplete(IoUringOp *op, int32_t res, uint32_t /*flags*/) {
+  op->res_ = res;
+  op->done_ = true;
+  if (op->cor_ != nullptr) {
+    Coroutine::Resume(op->cor_);
+  }
+}
+
+void IoUring::OnAcceptComplete(IoUringOp *op, int32_t res, uint32_t flags) {
+  auto *accept = static_cast<MultishotAccept *>(op);
+  if ((flags & IORING_CQE_F_MORE) == 0) {
+    accept->armed_ = false;
+  }
+  if (res == -EINVAL && accept->fds_.empty()) {
+    // kernel older than 5.19 rejects IORING_ACCEPT_MULTISHOT
+    LOG_WARN << "io_uring multishot accept not supported, fallback to epoll";
+    accept->ring_->multishot_accept_ = false;
+  } else if (res != -ECANCELED) {
+    accept->fds_.push_back(res);
+  }
+  if (accept->cor_ != nullptr) {
+    Coroutine::Resume(accept->cor_);
+  }
+}
+
+auto IoUring::Cancel(IoUringOp *op) -> bool {
+  io_uring_sqe *sqe = GetSqe();
+  if (sqe == nullptr) {
+    return false;
+  }
+  sqe->opcode = IORING_OP_ASYNC_CANCEL;
+  sqe->fd = -1;
+  sqe->addr = reinterpret_cast<uint64_t>(op);
+  sqe->user_data = 0;
+  return true;
+}
+
+auto IoUring::Wait(io_uring_sqe *sqe) -> int32_t {
+  IoUringOp op;
+  op.on_complete_ = &IoUring::OnOpComplete;
+  op.cor_ = Coroutine::GetCurrentCoroutine();
+  sqe->user_data = reinterpret_cast<uint64_t>(&op);
+
+  bool canceled = false;
+  std::shared_ptr<bool> waiting;
+  while (!op.done_) {
+    Coroutine::Yield();
+    if (!op.done_ && !canceled) {
+      // resumed by timer or others, kernel still holds op and buffer, cancel it and wait for the cqe
+      canceled = Cancel(&op);
+      if (!canceled) {
+        // sq is still full, nobody else may resume us, retry in next loop after kernel consumes it
+        if (!waiting) {
+          waiting = std::make_shared<bool>(true);
+        }
+        Reactor::GetReactor()->AddTask(
+            [cor = op.cor_, waiting]() {
+              if (*waiting) {
+                Coroutine::Resume(cor);
+              }
+            },
+            false);
+      }
+    }
+  }
+  if (waiting) {
+    *waiting = false;
+  }
+  return op.res_;
+}
+
+auto IoUring::Finish(int32_t r, ssize_t *res) -> bool {
+  if (r == -EAGAIN) {
+    return false;
+  }
+  if (r < 0) {
+    // canceled means coroutine is woken up by others, like a spurious wakeup of epoll
+    errno = r == -ECANCELED ? EAGAIN : -r;
+    *res = -1;
+    return true;
+  }
+  *res = r;
+  return true;
+}
+
+auto IoUring::Recv(int fd, void *buf, size_t len, int flags, ssize_t *res) -> bool {
+  io_uring_sqe *sqe = GetSqe();
+  if (sqe == nullptr) {
+    return false;
+  }
+  sqe->opcode = IORING_OP_RECV;
+  sqe->fd = fd;
+  sqe->addr = reinterpret_cast<uint64_t>(buf);
+  sqe->len = static_cast<uint32_t>(len);
+  sqe->msg_flags = static_cast<uint32_t>(flags);
+  return Finish(Wait(sqe), res);
+}
+
+auto IoUring::Send(int fd, const void *buf, size_t len, int flags, ssize_t *res) -> bool {
+  io_uring_sqe *sqe = GetSqe();
+  if (sqe == nullptr) {
+    return false;
+  }
+  sqe->opcode = IORING_OP_SEND;
+  sqe->fd = fd;
+  sqe->addr = reinterpret_cast<uint64_t>(buf);
+  sqe->len = static_cast<uint32_t>(len);
+  sqe->msg_flags = static_cast<uint32_t>(flags);
+  return Finish(Wait(sqe), res);
+}
+
+auto IoUring::Read(int fd, void *buf, size_t len, ssize_t *res) -> bool {
+  io_uring_sqe *sqe = GetSqe();
+  if (sqe == nullptr) {
+    return false;
+  }
+  sqe->opcode = IORING_OP_READ;
+  sqe->fd = fd;
+  sqe->off = static_cast<uint64_t>(-1);  // current file position, same as read(2)
+  sqe->addr = reinterpret_cast<uint64_t>(buf);
+  sqe->len = static_cast<uint32_t>(len);
+  return Finish(Wait(sqe), res);
+}
+
+auto IoUring::Write(int fd, const void *buf, size_t len, ssize_t *res) -> bool {
+  io_uring_sqe *sqe = GetSqe();
+  if (sqe == nullptr) {
+    return false;
+  }
+  sqe->opcode = IORING_OP_WRITE;
+  sqe->fd = fd;
+  sqe->off = static_cast<uint64_t>(-1);
+  sqe->addr = reinterpret_cast<uint64_t>(buf);
+  sqe->len = static_cast<uint32_t>(len);
+  return Finish(Wait(sqe), res);
+}
+
+auto IoUring::Poll(int fd, uint32_t events, int *res) -> bool {
+  io_uring_sqe *sqe = GetSqe();
+  if (sqe == nullptr) {
+    return false;
+  }
+  sqe->opcode = IORING_OP_POLL_ADD;
+  sqe->fd = fd;
+  sqe->poll32_events = events;
+  ssize_t n = 0;
+  if (!Finish(Wait(sqe), &n)) {
+    return false;
+  }
+  *res = static_cast<int>(n);
+  return true;
+}
+
+auto IoUring::Accept(int fd, sockaddr *addr, socklen_t *addrlen, int *res) -> bool {
+  if (!multishot_accept_) {
+    return false;
+  }
+  auto &accept = accepts_[fd];
+  if (accept == nullptr) {
+    accept = std::make_unique<MultishotAccept>();
+    accept->on_complete_ = &IoUring::OnAcceptComplete;
+    accept->ring_ = this;
+  }
+  if (accept->fds_.empty()) {
+    if (!accept->armed_) {
+      io_uring_sqe *sqe = GetSqe();
+      if (sqe == nullptr) {
+        return false;
+      }
+      sqe->opcode = IORING_OP_ACCEPT;
+      sqe->fd = fd;
+      sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+      sqe->user_data = reinterpret_cast<uint64_t>(accept.get());
+      accept->armed_ = true;
+    }
+    accept->cor_ = Coroutine::GetCurrentCoroutine();
+    Coroutine::Yield();
+    accept->cor_ = nullptr;
+    if (!multishot_accept_) {
+      return false;
+    }
+    if (accept->fds_.empty()) {
+      // woken up by others, the multishot accept keeps armed for next call
+      errno = EAGAIN;
+      *res = -1;
+      return true;
+    }
+  }
+
+  int new_fd = accept->fds_.front();
+  accept->fds_.pop_front();
+  if (new_fd < 0) {
+    errno = -new_fd;
+    *res = -1;
+    return true;
+  }
+  if (addr != nullptr && addrlen != nullptr && getpeername(new_fd, addr, addrlen) != 0) {
+    LOG_ERROR << "getpeername error, fd = " << new_fd << ", sys error=" << strerror(errno);
+  }
+  *res = new_fd;
+  return true;
+}
+
+}  // namespace tirpc
+
+#endif
@@ -0,0 +1,147 @@
+#pragma once
+
+#ifdef TIRPC_HAS_IO_URING
+
+#include <linux/io_uring.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <unordered_map>
+
+namespace tirpc {
+
+class Coroutine;
+
+/**
+ * @brief 提交到 io_uring 的一次操作，它的地址就是 SQE 的 user_data，CQE 到达时调用 on_complete_
+ *
+ */
+struct IoUringOp {
+  void (*on_complete_)(IoUringOp *op, int32_t res, uint32_t flags){nullptr};
+  Coroutine *cor_{nullptr};
+  int32_t res_{0};
+  bool done_{false};
+};
+
+/**
+ * @brief 每个 Reactor 一个的 io_uring，直接用系统调用实现，不依赖 liburing
+ *
+ * 协程在 hook 中提交 SQE 后挂起，Reactor 在 epoll_wait 之前统一提交，ring fd 注册在 epoll 上，
+ * 可读时收割 CQE 并唤醒对应协程。SQ 和 CQ 只能由 Reactor 所在线程访问
+ */
+class IoUring {
+ public:
+  /**
+   * @brief 创建 io_uring，内核不支持时返回 nullptr
+   */
+  static auto Create(unsigned entries) -> std::unique_ptr<IoUring>;
+
+  ~IoUring();
+
+  IoUring(const IoUring &) = delete;
+  auto operator=(const IoUring &) -> IoUring & = delete;
+
+  auto GetFd() const -> int { return ring_fd_; }
+
+  /**
+   * @brief 提交所有已填好的 SQE，Reactor 在等待事件前调用
+   */
+  void Submit();
+
+  /**
+   * @brief 收割所有 CQE 并调用对应操作的完成回调
+   */
+  void Reap();
+
+  /**
+   * @brief 以下操作在当前协程中提交请求并挂起直到完成，res 为系统调用的返回值，出错时设置 errno。
+   * 返回 false 表示没能通过 io_uring 完成(SQ 已满或内核要求非阻塞 fd 返回 EAGAIN)，调用方应回退到 epoll
+   */
+  auto Recv(int fd, void *buf, size_t len, int flags, ssize_t *res) -> bool;
+
+  auto Send(int fd, const void *buf, size_t len, int flags, ssize_t *res) -> bool;
+
+  auto Read(int fd, void *buf, size_t len, ssize_t *res) -> bool;
+
+  auto Write(int fd, const void *buf, size_t len, ssize_t *res) -> bool;
+
+  /**
+   * @brief 等待 fd 上的 poll 事件，用于 connect 等没有对应完成语义的操作
+   */
+  auto Poll(int fd, uint32_t events, int *res) -> bool;
+
+  /**
+   * @brief 从监听 fd 上取一个连接。内核支持时每个监听 fd 只提交一次 multishot accept，多余的连接缓存在队列中
+   */
+  auto Accept(int fd, sockaddr *addr, socklen_t *addrlen, int *res) -> bool;
+
+ private:
+  IoUring() = default;
+
+  /**
+   * @brief 一个监听 fd 上常驻的 multishot accept
+   */
+  struct MultishotAccept : public IoUringOp {
+    IoUring *ring_{nullptr};
+    std::deque<int> fds_;  // accepted fds, negative value is -errno
+    bool armed_{false};
+  };
+
+  auto GetSqe() -> io_uring_sqe *;
+
+  /**
+   * @brief 提交 sqe 对应的操作并挂起当前协程直到 CQE 到达。
+   * 协程被超时等其他原因唤醒时取消该操作并继续等待，保证返回后内核不再访问 op 引用的内存
+   */
+  auto Wait(io_uring_sqe *sqe) -> int32_t;
+
+  /**
+   * @brief 提交取消 op 的请求，sq 满且内核暂时无法消费时返回 false，调用者稍后需要重试
+   */
+  auto Cancel(IoUringOp *op) -> bool;
+
+  /**
+   * @brief cq 溢出后内核把 CQE 暂存在溢出链表里，ring fd 不再可读，需要主动让内核刷回 cq
+   */
+  auto IsCqOverflow() const -> bool;
+
+  /**
+   * @brief 把 CQE 的结果转换成系统调用的返回值和 errno，返回 false 表示需要回退到 epoll
+   */
+  static auto Finish(int32_t r, ssize_t *res) -> bool;
+
+  static void OnOpComplete(IoUringOp *op, int32_t res, uint32_t flags);
+
+  static void OnAcceptComplete(IoUringOp *op, int32_t res, uint32_t flags);
+
+ private:
+  int ring_fd_{-1};
+  unsigned sq_entries_{0};
+
+  void *sq_ring_{nullptr};
+  size_t sq_ring_size_{0};
+  void *cq_ring_{nullptr};
+  size_t cq_ring_size_{0};
+  io_uring_sqe *sqes_{nullptr};
+
+  unsigned *sq_head_{nullptr};
+  unsigned *sq_tail_{nullptr};
+  unsigned *sq_flags_{nullptr};
+  unsigned sq_mask_{0};
+  unsigned *cq_head_{nullptr};
+  unsigned *cq_tail_{nullptr};
+  unsigned cq_mask_{0};
+  io_uring_cqe *cqes_{nullptr};
+
+  unsigned sqe_tail_{0};   // sqes filled by this thread, published to kernel on Submit
+  unsigned to_submit_{0};  // published but not consumed by kernel
+
+  bool multishot_accept_{true};  // cleared when kernel rejects IORING_ACCEPT_MULTISHOT
+  std::unordered_map<int, std::unique_ptr<MultishotAccept>> accepts_;
+};
+
+}  // namespace tirpc
+
+#endif
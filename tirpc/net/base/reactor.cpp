@@ -5,7 +5,9 @@
 #include <sys/socket.h>
 #include <algorithm>
 #include <cassert>
+#include <chrono>
 #include <cstring>
+#include <random>
 
 #include "tirpc/common/config.hpp"
 #include "tirpc/common/log.hpp"
@@ -13,6 +15,7 @@
 #include "tirpc/coroutine/coroutine.hpp"
 #include "tirpc/coroutine/coroutine_hook.hpp"
 #include "tirpc/net/base/fd_event.hpp"
+#include "tirpc/net/base/io_uring.hpp"
 #include "tirpc/net/base/timer.hpp"
 
 extern read_fun_ptr_t g_sys_read_fun;    // sys read func
@@ -22,6 +25,18 @@ namespace tirpc {
 
 static ConfigVar<int>::ptr g_iothread_num = Config::Lookup("iothread_num", 1, "IO thread number");
 static ConfigVar<bool>::ptr g_use_lock_free = Config::Lookup("use_lock_free", false, "wheather to use lock free queue");
+static ConfigVar<int>::ptr g_init_epoll_events =
+    Config::Lookup("reactor.init_epoll_events", 64, "max events of one epoll_wait when loop start");
+static ConfigVar<int>::ptr g_max_epoll_events =
+    Config::Lookup("reactor.max_epoll_events", 1024, "upper limit of max events of one epoll_wait");
+static ConfigVar<int>::ptr g_busy_poll_us =
+    Config::Lookup("reactor.busy_poll_us", 0, "time of busy poll before block in epoll_wait, us. 0 means not busy poll");
+static ConfigVar<std::string>::ptr g_io_backend =
+    Config::Lookup("reactor.io_backend", std::string("epoll"), "io backend of hooked socket io, epoll or io_uring");
+static ConfigVar<int>::ptr g_io_uring_entries =
+    Config::Lookup("reactor.io_uring_entries", 256, "sq entries of io_uring of one reactor");
+
+static const int MIN_BUSY_POLL_US = 1;  // idle reactor still spins a little, so that burst can be caught quickly
 
 static thread_local Reactor *t_reactor_ptr = nullptr;
 
@@ -29,6 +44,63 @@ static thread_local int t_max_epoll_timeout = 10000;  // ms
 
 static CoroutineTaskQueue *t_coroutine_task_queue = nullptr;
 
+static const int TASK_NODE_CHUNK_SIZE = 64;     // task nodes allocated from heap at a time
+static const int MAX_LOCAL_FREE_TASK_NODE = 256;  // free task nodes kept by one thread before give back
+static const int MAX_TASKS_PER_LOOP = 1024;     // lock free tasks run in one loop, avoid starving io events
+
+// shared free task nodes. threads only push nodes or take all of them, so it's free from ABA problem
+static std::atomic<TaskNode *> g_free_task_nodes{nullptr};
+
+static thread_local TaskNode *t_task_node_cache = nullptr;  // nodes to alloc
+static thread_local TaskNode *t_freed_task_nodes = nullptr;  // nodes freed by this thread
+static thread_local TaskNode *t_freed_task_nodes_tail = nullptr;
+static thread_local int t_freed_task_node_count = 0;
+
+static auto AllocTaskNode() -> TaskNode * {
+  if (t_task_node_cache == nullptr) {
+    if (t_freed_task_nodes != nullptr) {
+      t_task_node_cache = t_freed_task_nodes;
+      t_freed_task_nodes = nullptr;
+      t_freed_task_nodes_tail = nullptr;
+      t_freed_task_node_count = 0;
+    } else {
+      t_task_node_cache = g_free_task_nodes.exchange(nullptr, std::memory_order_acquire);
+    }
+  }
+  if (t_task_node_cache == nullptr) {
+    // nodes never go back to heap, they are bounded by max count of tasks in flight
+    auto *chunk = new TaskNode[TASK_NODE_CHUNK_SIZE];
+    for (int i = 0; i < TASK_NODE_CHUNK_SIZE - 1; ++i) {
+      chunk[i].next_.store(&chunk[i + 1], std::memory_order_relaxed);
+    }
+    t_task_node_cache = chunk;
+  }
+  TaskNode *node = t_task_node_cache;
+  t_task_node_cache = node->next_.load(std::memory_order_relaxed);
+  return node;
+}
+
+static void FreeTaskNode(TaskNode *node) {
+  node->task_ = nullptr;
+  node->next_.store(t_freed_task_nodes, std::memory_order_relaxed);
+  if (t_freed_task_nodes == nullptr) {
+    t_freed_task_nodes_tail = node;
+  }
+  t_freed_task_nodes = node;
+  if (++t_freed_task_node_count < MAX_LOCAL_FREE_TASK_NODE) {
+    return;
+  }
+  // consumer thread frees more nodes than it allocs, give them back to producers
+  TaskNode *head = g_free_task_nodes.load(std::memory_order_relaxed);
+  do {
+    t_freed_task_nodes_tail->next_.store(head, std::memory_order_relaxed);
+  } while (!g_free_task_nodes.compare_exchange_weak(head, t_freed_task_nodes, std::memory_order_release,
+                                                    std::memory_order_relaxed));
+  t_freed_task_nodes = nullptr;
+  t_freed_task_nodes_tail = nullptr;
+  t_freed_task_node_count = 0;
+}
+
 Reactor::Reactor() {
   // one thread can't create more than one reactor object!!
   // assert(t_reactor_ptr == nullptr);
@@ -57,10 +129,23 @@ Reactor::Reactor() {
   LOG_DEBUG << "wakefd = " << wakeup_fd_;
   // assert(wakeup_fd_ > 0);
   AddWakeupFd();
+
+  use_lock_free_ = g_use_lock_free->GetValue();
+
+  if (g_io_backend->GetValue() == "io_uring") {
+    AddIoUring();
+  }
 }
 
 Reactor::~Reactor() {
   LOG_DEBUG << "~Reactor";
+  while (TaskNode *node = task_queue_.Pop()) {
+    FreeTaskNode(node);
+  }
+#ifdef TIRPC_HAS_IO_URING
+  delete io_uring_;
+  io_uring_ = nullptr;
+#endif
   close(epfd_);
   if (timer_ != nullptr) {
     delete timer_;
@@ -118,11 +203,24 @@ void Reactor::DelEvent(int fd, bool is_wakeup /*=true*/) {
   }
 }
 
+void Reactor::DelStolenEvent(int fd) {
+  // epoll_ctl is thread safe, registered_fds_ is only touched by loop thread and left stale
+  if (epoll_ctl(epfd_, EPOLL_CTL_DEL, fd, nullptr) != 0 && errno != ENOENT) {
+    LOG_ERROR << "epoo_ctl error, fd[" << fd << "], sys errinfo = " << strerror(errno);
+  }
+}
+
 void Reactor::Wakeup() {
-  if (!is_looping_) {
+  // loop thread will check pending work before block, so it's no need to wake it up when it's running.
+  // seq_cst pairs with polling_ store + HasPendingWork in Loop, one of them must see the other
+  if (!polling_.load(std::memory_order_seq_cst)) {
+    return;
+  }
+  if (notified_.exchange(true, std::memory_order_acq_rel)) {
     return;
   }
 
+  wakeup_count_.fetch_add(1, std::memory_order_relaxed);
   uint64_t tmp = 1;
   uint64_t *p = &tmp;
   if (g_sys_write_fun(wakeup_fd_, p, 8) != 8) {
@@ -141,7 +239,39 @@ void Reactor::AddWakeupFd() {
   if ((epoll_ctl(epfd_, op, wakeup_fd_, &event)) != 0) {
     LOG_ERROR << "epoo_ctl error, fd[" << wakeup_fd_ << "], errno=" << errno << ", err=" << strerror(errno);
   }
-  fds_.push_back(wakeup_fd_);
+  SetFdRegistered(wakeup_fd_, true);
+}
+
+void Reactor::AddIoUring() {
+#ifdef TIRPC_HAS_IO_URING
+  std::unique_ptr<IoUring> ring = IoUring::Create(std::max(g_io_uring_entries->GetValue(), 1));
+  if (ring == nullptr) {
+    LOG_WARN << "create io_uring failed, fallback to epoll";
+    return;
+  }
+  epoll_event event;
+  event.data.fd = ring->GetFd();
+  event.events = EPOLLIN;
+  if ((epoll_ctl(epfd_, EPOLL_CTL_ADD, ring->GetFd(), &event)) != 0) {
+    LOG_ERROR << "epoo_ctl error, fd[" << ring->GetFd() << "], errno=" << errno << ", err=" << strerror(errno);
+    return;
+  }
+  SetFdRegistered(ring->GetFd(), true);
+  io_uring_ = ring.release();
+  LOG_DEBUG << "io backend is io_uring, fd = " << io_uring_->GetFd();
+#else
+  LOG_WARN << "tirpc is built without io_uring, fallback to epoll";
+#endif
+}
+
+void Reactor::SetFdRegistered(int fd, bool registered) {
+  if (fd >= static_cast<int>(registered_fds_.size())) {
+    if (!registered) {
+      return;
+    }
+    registered_fds_.resize(std::max(static_cast<size_t>(fd + 1), 2 * registered_fds_.size()), 0);
+  }
+  registered_fds_[fd] = registered ? 1 : 0;
 }
 
 // need't mutex, only this thread call
@@ -149,11 +279,8 @@ void Reactor::AddEventInLoopThread(int fd, epoll_event event) {
   assert(IsLoopThread());
 
   int op = EPOLL_CTL_ADD;
-  bool is_add = true;
   // int tmp_fd = event;
-  auto it = find(fds_.begin(), fds_.end(), fd);
-  if (it != fds_.end()) {
-    is_add = false;
+  if (IsFdRegistered(fd)) {
     op = EPOLL_CTL_MOD;
   }
 
@@ -161,13 +288,17 @@ void Reactor::AddEventInLoopThread(int fd, epoll_event event) {
   // event.data.ptr = fd_event.get();
   // event.events = fd_event->getListenEvents();
 
-  if (epoll_ctl(epfd_, op, fd, &event) != 0) {
+  int rt = epoll_ctl(epfd_, op, fd, &event);
+  if (rt != 0 && (errno == ENOENT || errno == EEXIST)) {
+    // fd closed(so removed by kernel) or migrated between reactors without del, registered_fds_ is stale
+    op = errno == ENOENT ? EPOLL_CTL_ADD : EPOLL_CTL_MOD;
+    rt = epoll_ctl(epfd_, op, fd, &event);
+  }
+  if (rt != 0) {
     LOG_ERROR << "epoo_ctl error, fd[" << fd << "], sys errinfo = " << strerror(errno);
     return;
   }
-  if (is_add) {
-    fds_.push_back(fd);
-  }
+  SetFdRegistered(fd, true);
   LOG_DEBUG << "epoll_ctl add succ, fd[" << fd << "]";
 }
 
@@ -175,18 +306,18 @@ void Reactor::AddEventInLoopThread(int fd, epoll_event event) {
 void Reactor::DelEventInLoopThread(int fd) {
   assert(IsLoopThread());
 
-  auto it = find(fds_.begin(), fds_.end(), fd);
-  if (it == fds_.end()) {
+  if (!IsFdRegistered(fd)) {
     LOG_DEBUG << "fd[" << fd << "] not in this loop";
     return;
   }
   int op = EPOLL_CTL_DEL;
 
-  if ((epoll_ctl(epfd_, op, fd, nullptr)) != 0) {
+  // ENOENT: fd has been closed or deleted by the reactor which stole its coroutine
+  if ((epoll_ctl(epfd_, op, fd, nullptr)) != 0 && errno != ENOENT) {
     LOG_ERROR << "epoo_ctl error, fd[" << fd << "], sys errinfo = " << strerror(errno);
   }
 
-  fds_.erase(it);
+  SetFdRegistered(fd, false);
   LOG_DEBUG << "del succ, fd[" << fd << "]";
 }
 
@@ -199,57 +330,97 @@ void Reactor::Loop() {
 
   is_looping_ = true;
   stop_ = false;
+  // timers and deadlines of this thread read the time refreshed once per round
+  SetNowMsCached(true);
 
-  while (!stop_) {
-    const int max_events = 10;
-    epoll_event re_events[max_events + 1];
+  int max_events_limit = std::max(g_max_epoll_events->GetValue(), 1);
+  if (epoll_events_.empty()) {
+    epoll_events_.resize(std::min(std::max(g_init_epoll_events->GetValue(), 1), max_events_limit));
+    batch_size_.store(static_cast<int>(epoll_events_.size()), std::memory_order_relaxed);
+  }
+  if (busy_poll_max_us_ < 0) {
+    busy_poll_max_us_ = std::max(g_busy_poll_us->GetValue(), 0);
+  }
+  busy_poll_us_ = busy_poll_max_us_;
 
+  while (!stop_) {
     // 先处理完队列中的任务（只有 IOThread 做）
     if (type_ == SubReactor) {
       if (CoroutineTaskQueue::GetCoroutineTaskQueue()->Empty(thread_idx_)) {
         auto steal_tasks = CoroutineTaskQueue::GetCoroutineTaskQueue()->Steal(thread_idx_, 16);
         for (auto &task : steal_tasks) {
           if (task != nullptr) {
-            task->SetReactor(this);
+            task->MoveToReactor(this);
             Coroutine::Resume(task->GetCoroutine());
           }
         }
       } else {
-        while (true) {
-          auto tasks = CoroutineTaskQueue::GetCoroutineTaskQueue()->PopSome(thread_idx_, 16);
-          if (tasks.empty()) {
-            break;
-          }
-          for (auto &task : tasks) {
-            task->SetReactor(this);
-            Coroutine::Resume(task->GetCoroutine());
-          }
+        FdEvent *task = nullptr;
+        while ((task = CoroutineTaskQueue::GetCoroutineTaskQueue()->Pop(thread_idx_)) != nullptr) {
+          task->SetReactor(this);
+          Coroutine::Resume(task->GetCoroutine());
         }
       }
     }
 
     // 执行 pending_tasks_ 中的任务
-    Mutex::Locker lock1(mutex_);
-    std::vector<std::function<void()>> tmp_tasks;
-    tmp_tasks.swap(pending_tasks_);
-    lock1.Unlock();
-
-    for (auto &tmp_task : tmp_tasks) {
-      if (tmp_task) {
-        tmp_task();
-      }
+    bool has_more_tasks = RunPendingTasks();
+
+#ifdef TIRPC_HAS_IO_URING
+    if (io_uring_ != nullptr) {
+      // io requested by coroutines in this round
+      io_uring_->Submit();
     }
+#endif
 
     // epoll 等待事件
-    int rt = epoll_wait(epfd_, re_events, max_events, t_max_epoll_timeout);
+    int max_events = static_cast<int>(epoll_events_.size());
+    int rt = 0;
+    int64_t wait_us = 0;
+    if (has_more_tasks || !BusyPoll(&rt)) {
+      int timeout = 0;
+      if (!has_more_tasks) {
+        // from now on producers write wakeup fd, check again for work posted before they could see it
+        polling_.store(true, std::memory_order_seq_cst);
+        if (HasPendingWork()) {
+          polling_.store(false, std::memory_order_relaxed);
+        } else {
+          timeout = t_max_epoll_timeout;
+        }
+      }
+      // only a wait which may block is timed, it's idle then. rounds under load don't read clock for stats
+      std::chrono::steady_clock::time_point wait_begin;
+      if (timeout != 0) {
+        wait_begin = std::chrono::steady_clock::now();
+      }
+      rt = epoll_wait(epfd_, epoll_events_.data(), max_events, timeout);
+      if (timeout != 0) {
+        wait_us =
+            std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - wait_begin).count();
+      }
+      polling_.store(false, std::memory_order_relaxed);
+      notified_.store(false, std::memory_order_relaxed);
+      if (rt > 0 && timeout != 0 && busy_poll_max_us_ > 0) {
+        // traffic comes again, spin longer next time
+        busy_poll_us_ = std::min(busy_poll_us_ * 2, busy_poll_max_us_);
+      }
+    }
+    UpdateNowMs();
+
+    // only loop thread writes them, relaxed load + store is enough
+    loop_count_.store(loop_count_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    wait_time_us_.store(wait_time_us_.load(std::memory_order_relaxed) + wait_us, std::memory_order_relaxed);
 
     if (rt < 0) {
-      LOG_ERROR << "epoll_wait error, skip, errno=" << strerror(errno);
+      if (errno != EINTR) {
+        LOG_ERROR << "epoll_wait error, skip, errno=" << strerror(errno);
+      }
       continue;
     }
+    event_count_.store(event_count_.load(std::memory_order_relaxed) + rt, std::memory_order_relaxed);
 
     for (int i = 0; i < rt; ++i) {
-      epoll_event event = re_events[i];
+      epoll_event event = epoll_events_[i];
 
       if (event.data.fd == wakeup_fd_ && (event.events & READ)) {
         // Wakeup 事件，将缓冲中的内容读完即可
@@ -261,6 +432,12 @@ void Reactor::Loop() {
         }
         continue;
       }
+#ifdef TIRPC_HAS_IO_URING
+      if (io_uring_ != nullptr && event.data.fd == io_uring_->GetFd()) {
+        io_uring_->Reap();
+        continue;
+      }
+#endif
       auto *ptr = static_cast<FdEvent *>(event.data.ptr);
 
       if (ptr == nullptr) {
@@ -280,8 +457,16 @@ void Reactor::Loop() {
       // 协程事件
       if (ptr->GetCoroutine() != nullptr) {
         if (type_ == SubReactor) {
-          DelEventInLoopThread(fd);
-          ptr->SetReactor(nullptr);
+          if (!ptr->IsOneShot()) {
+            // make sure this coroutine is pushed only once
+            DelEventInLoopThread(fd);
+          }
+          if (ptr->GetCoroutine()->IsSharedStack()) {
+            // its frames are kept by shared stacks of this thread, other io threads can't steal it
+            Coroutine::Resume(ptr->GetCoroutine());
+            continue;
+          }
+          // reactor is kept, the thread which steals it moves registration away from this epoll
           CoroutineTaskQueue::GetCoroutineTaskQueue()->Push(thread_idx_, ptr);
         } else {
           // main reactor, just resume this coroutine. it is accept coroutine. and Main Reactor only have this
@@ -304,12 +489,10 @@ void Reactor::Loop() {
       write_cb = ptr->GetCallBack(WRITE);
 
       if ((event.events & EPOLLIN) != 0U) {
-        Mutex::Locker lock(mutex_);
-        pending_tasks_.push_back(read_cb);
+        loop_tasks_.push_back(read_cb);
       }
       if ((event.events & EPOLLOUT) != 0U) {
-        Mutex::Locker lock2(mutex_);
-        pending_tasks_.push_back(write_cb);
+        loop_tasks_.push_back(write_cb);
       }
     }
 
@@ -332,8 +515,20 @@ void Reactor::Loop() {
     for (int &i : tmp_del) {
       DelEventInLoopThread(i);
     }
+
+    // more events may be ready, fetch more in one epoll_wait next time.
+    // resize after events handled since they are stored in epoll_events_
+    if (rt == max_events) {
+      full_batch_count_.store(full_batch_count_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+      if (max_events < max_events_limit) {
+        epoll_events_.resize(std::min(max_events * 2, max_events_limit));
+        batch_size_.store(static_cast<int>(epoll_events_.size()), std::memory_order_relaxed);
+        LOG_DEBUG << "epoll_wait returns full batch, grow max events to " << epoll_events_.size();
+      }
+    }
   }
   is_looping_ = false;
+  SetNowMsCached(false);
 }
 
 void Reactor::Stop() {
@@ -343,10 +538,90 @@ void Reactor::Stop() {
   }
 }
 
+auto Reactor::RunPendingTasks() -> bool {
+  if (timer_ != nullptr) {
+    // timer events added or deleted by other threads
+    timer_->HandlePendingEvents();
+  }
+
+  std::vector<std::function<void()>> tmp_tasks;
+  tmp_tasks.swap(loop_tasks_);
+
+  if (!use_lock_free_) {
+    Mutex::Locker lock(mutex_);
+    if (tmp_tasks.empty()) {
+      tmp_tasks.swap(pending_tasks_);
+    } else {
+      tmp_tasks.insert(tmp_tasks.end(), pending_tasks_.begin(), pending_tasks_.end());
+      pending_tasks_.clear();
+    }
+  }
+
+  for (auto &tmp_task : tmp_tasks) {
+    if (tmp_task) {
+      tmp_task();
+    }
+  }
+
+  int count = 0;
+  while (count < MAX_TASKS_PER_LOOP) {
+    TaskNode *node = task_queue_.Pop();
+    if (node == nullptr) {
+      break;
+    }
+    if (node->task_) {
+      node->task_();
+    }
+    FreeTaskNode(node);
+    ++count;
+  }
+
+  return !loop_tasks_.empty() || count == MAX_TASKS_PER_LOOP;
+}
+
+auto Reactor::BusyPoll(int *rt) -> bool {
+  if (busy_poll_max_us_ <= 0) {
+    return false;
+  }
+  int max_events = static_cast<int>(epoll_events_.size());
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::microseconds(busy_poll_us_);
+  do {
+    *rt = epoll_wait(epfd_, epoll_events_.data(), max_events, 0);
+    if (*rt != 0 || HasPendingWork()) {
+      busy_poll_us_ = busy_poll_max_us_;
+      return true;
+    }
+  } while (std::chrono::steady_clock::now() < deadline);
+
+  // nothing comes in budget, back off so that an idle reactor doesn't burn the cpu
+  busy_poll_us_ = std::max(busy_poll_us_ / 2, MIN_BUSY_POLL_US);
+  return false;
+}
+
+auto Reactor::HasPendingWork() -> bool {
+  if (stop_ || !loop_tasks_.empty() || !task_queue_.Empty()) {
+    return true;
+  }
+  if (timer_ != nullptr && timer_->HasPendingEvents()) {
+    return true;
+  }
+  Mutex::Locker lock(mutex_);
+  return !pending_tasks_.empty() || !pending_add_fds_.empty() || !pending_del_fds_.empty();
+}
+
 void Reactor::AddTask(std::function<void()> task, bool is_wakeup /*=true*/) {
-  {
+  if (IsLoopThread()) {
+    // loop won't block in epoll_wait when it has tasks of itself, so needn't wakeup
+    loop_tasks_.push_back(std::move(task));
+    return;
+  }
+  if (use_lock_free_) {
+    TaskNode *node = AllocTaskNode();
+    node->task_ = std::move(task);
+    task_queue_.Push(node);
+  } else {
     Mutex::Locker lock(mutex_);
-    pending_tasks_.push_back(task);
+    pending_tasks_.push_back(std::move(task));
   }
   if (is_wakeup) {
     Wakeup();
@@ -358,7 +633,17 @@ void Reactor::AddTask(std::vector<std::function<void()>> task, bool is_wakeup /*
     return;
   }
 
-  {
+  if (IsLoopThread()) {
+    loop_tasks_.insert(loop_tasks_.end(), task.begin(), task.end());
+    return;
+  }
+  if (use_lock_free_) {
+    for (auto &i : task) {
+      TaskNode *node = AllocTaskNode();
+      node->task_ = std::move(i);
+      task_queue_.Push(node);
+    }
+  } else {
     Mutex::Locker lock(mutex_);
     pending_tasks_.insert(pending_tasks_.end(), task.begin(), task.end());
   }
@@ -384,9 +669,21 @@ auto Reactor::GetTid() -> pid_t { return tid_; }
 
 void Reactor::SetReactorType(ReactorType type) { type_ = type; }
 
+auto Reactor::GetStats() const -> ReactorStats {
+  ReactorStats stats;
+  stats.loop_count_ = loop_count_.load(std::memory_order_relaxed);
+  stats.event_count_ = event_count_.load(std::memory_order_relaxed);
+  stats.full_batch_count_ = full_batch_count_.load(std::memory_order_relaxed);
+  stats.wait_time_us_ = wait_time_us_.load(std::memory_order_relaxed);
+  stats.wakeup_count_ = wakeup_count_.load(std::memory_order_relaxed);
+  stats.batch_size_ = batch_size_.load(std::memory_order_relaxed);
+  return stats;
+}
+
 CoroutineTaskQueue::CoroutineTaskQueue() {
-  tasks_.resize(g_iothread_num->GetValue());
-  mutexs_.resize(g_iothread_num->GetValue());
+  for (int i = 0; i < g_iothread_num->GetValue(); ++i) {
+    tasks_.push_back(std::make_unique<WorkStealDeque<FdEvent *>>());
+  }
 }
 
 auto CoroutineTaskQueue::GetCoroutineTaskQueue() -> CoroutineTaskQueue * {
@@ -397,44 +694,42 @@ auto CoroutineTaskQueue::GetCoroutineTaskQueue() -> CoroutineTaskQueue * {
   return t_coroutine_task_queue;
 }
 
-void CoroutineTaskQueue::Push(int thread_idx, FdEvent *cor) {
-  Mutex::Locker lock(mutexs_[thread_idx]);
-  tasks_[thread_idx].push(cor);
-  lock.Unlock();
-}
+void CoroutineTaskQueue::Push(int thread_idx, FdEvent *cor) { tasks_[thread_idx]->Push(cor); }
 
-auto CoroutineTaskQueue::PopSome(int thread_idx, int pop_cnt) -> std::vector<FdEvent *> {
-  std::vector<FdEvent *> vec;
-  int cnt = 0;
-  Mutex::Locker lock(mutexs_[thread_idx]);
-  while (!tasks_[thread_idx].empty() && cnt != pop_cnt) {
-    vec.push_back(tasks_[thread_idx].front());
-    tasks_[thread_idx].pop();
-    cnt++;
-  }
-  lock.Unlock();
+auto CoroutineTaskQueue::Pop(int thread_idx) -> FdEvent * { return tasks_[thread_idx]->Pop(); }
 
-  return vec;
-}
-
-bool CoroutineTaskQueue::Empty(int thread_idx) {
-  Mutex::Locker lock(mutexs_[thread_idx]);
-  return tasks_[thread_idx].empty();
-}
+bool CoroutineTaskQueue::Empty(int thread_idx) { return tasks_[thread_idx]->Empty(); }
 
 std::vector<FdEvent *> CoroutineTaskQueue::Steal(int thread_idx, int steal_cnt) {
   std::vector<FdEvent *> steal_tasks;
+  int n = static_cast<int>(tasks_.size());
+  if (n <= 1) {
+    return steal_tasks;
+  }
 
-  int cnt = 0;
-  for (int i = 0; i < static_cast<int>(tasks_.size()); i++) {
-    if (cnt == steal_cnt) break;
-    if (i == thread_idx) continue;
-    Mutex::Locker lock(mutexs_[i]);
-    while (!tasks_[i].empty() && cnt < steal_cnt) {
-      auto task = tasks_[i].front();
-      tasks_[i].pop();
+  // start from a random victim, so idle threads don't all rush to the same one
+  static thread_local std::minstd_rand t_rand(std::random_device{}());
+  int start = static_cast<int>(t_rand() % n);
+  for (int k = 0; k < n; ++k) {
+    int i = (start + k) % n;
+    if (i == thread_idx) {
+      continue;
+    }
+    int64_t size = tasks_[i]->Size();
+    if (size == 0) {
+      continue;
+    }
+    // steal half, victim keeps the other half hot in its cache
+    int64_t cnt = std::min<int64_t>(steal_cnt, (size + 1) / 2);
+    for (int64_t j = 0; j < cnt; ++j) {
+      FdEvent *task = tasks_[i]->Steal();
+      if (task == nullptr) {
+        break;
+      }
       steal_tasks.push_back(task);
-      cnt++;
+    }
+    if (!steal_tasks.empty()) {
+      break;
     }
   }
   return steal_tasks;
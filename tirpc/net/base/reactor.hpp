@@ -2,12 +2,15 @@
 
 #include <sys/epoll.h>
 #include <atomic>
+#include <cstdint>
 #include <functional>
 #include <map>
 #include <memory>
 #include <vector>
 
+#include "tirpc/common/mpsc_queue.hpp"
 #include "tirpc/common/mutex.hpp"
+#include "tirpc/common/work_steal_deque.hpp"
 #include "tirpc/coroutine/coroutine.hpp"
 
 namespace tirpc {
@@ -20,8 +23,31 @@ enum ReactorType {
 };
 
 class FdEvent;
+class IoUring;
 class Timer;
 
+/**
+ * @brief 无锁任务队列的节点，从节点池中分配，任务执行完后回收复用
+ *
+ */
+struct TaskNode {
+  std::atomic<TaskNode *> next_{nullptr};
+  std::function<void()> task_;
+};
+
+/**
+ * @brief Reactor 事件循环的累计统计，由 loop 线程更新，其他线程读取到的是近似值
+ *
+ */
+struct ReactorStats {
+  uint64_t loop_count_{0};        // times of epoll_wait
+  uint64_t event_count_{0};       // events returned by epoll_wait
+  uint64_t full_batch_count_{0};  // times of epoll_wait returned a full batch
+  uint64_t wait_time_us_{0};      // time blocked in epoll_wait
+  uint64_t wakeup_count_{0};      // writes to wakeup fd, sample it to get wakeup syscalls per second
+  int batch_size_{0};             // current max events of one epoll_wait
+};
+
 class Reactor {
  public:
   using ptr = std::shared_ptr<Reactor>;
@@ -34,6 +60,12 @@ class Reactor {
 
   void DelEvent(int fd, bool is_wakeup = true);
 
+  /**
+   * @brief 由其他线程直接把 fd 从本 reactor 的 epoll 中删除，用于 fd 的协程被偷走时
+   * 调用者要保证本线程此时不会操作这个 fd，本线程的注册记录会在下次注册时被纠正
+   */
+  void DelStolenEvent(int fd);
+
   void AddTask(std::function<void()> task, bool is_wakeup = true);
 
   void AddTask(std::vector<std::function<void()>> tasks, bool is_wakeup = true);
@@ -54,72 +86,156 @@ class Reactor {
 
   void SetReactorType(ReactorType type);
 
+  /**
+   * @brief 获取事件循环的统计信息，用于调优 IO 线程数和 epoll 批大小
+   */
+  auto GetStats() const -> ReactorStats;
+
+  /**
+   * @brief 设置忙轮询时间，loop 阻塞在 epoll_wait 之前先轮询 max_us 微秒，空闲时轮询时间逐渐减半。
+   * 0 表示关闭，默认使用配置 reactor.busy_poll_us，需要在 Loop 之前调用
+   */
+  void SetBusyPoll(int max_us) { busy_poll_max_us_ = max_us; }
+
+  /**
+   * @brief 获取本 Reactor 的 io_uring，配置 reactor.io_backend 不是 io_uring 或者内核不支持时返回 nullptr
+   */
+  auto GetIoUring() -> IoUring * { return io_uring_; }
+
  public:
   static auto GetReactor() -> Reactor *;
 
  private:
   void AddWakeupFd();
 
+  /**
+   * @brief 创建 io_uring 并把它的 fd 注册到 epoll，失败时回退到 epoll
+   */
+  void AddIoUring();
+
   auto IsLoopThread() const -> bool;
 
   void AddEventInLoopThread(int fd, epoll_event event);
 
   void DelEventInLoopThread(int fd);
 
+  auto IsFdRegistered(int fd) const -> bool {
+    return fd < static_cast<int>(registered_fds_.size()) && registered_fds_[fd] != 0;
+  }
+
+  void SetFdRegistered(int fd, bool registered);
+
+  /**
+   * @brief 执行其他线程投递的任务和本线程产生的任务
+   *
+   * @return 还有任务没有执行完，本轮 epoll_wait 不能阻塞
+   */
+  auto RunPendingTasks() -> bool;
+
+  /**
+   * @brief 是否有其他线程投递的任务或 fd 变更还没处理，loop 线程阻塞前调用
+   */
+  auto HasPendingWork() -> bool;
+
+  /**
+   * @brief 在预算时间内以 0 超时轮询 epoll 和任务队列
+   *
+   * @param rt epoll_wait 的返回值
+   * @return 轮询到了事件或任务，本轮不需要阻塞
+   */
+  auto BusyPoll(int *rt) -> bool;
+
  private:
   int epfd_{-1};
   int wakeup_fd_{-1};
   int timer_fd_{-1};
-  bool stop_{false};
+  std::atomic<bool> stop_{false};
   bool is_looping_{false};
 
+  // true when loop thread is about to block or blocked in epoll_wait, only then producers need write wakeup fd
+  std::atomic<bool> polling_{false};
+  // wakeup fd has been written since loop thread blocked, later producers needn't write it again
+  std::atomic<bool> notified_{false};
+
   int thread_idx_{-1};
 
   pid_t tid_{0};
 
   Mutex mutex_;
 
-  std::vector<int> fds_;
+  // indexed by fd, 1 means fd has been added to epoll of this reactor. fds are dense small integers,
+  // so add/mod/del lookup is O(1) no matter how many connections this reactor holds
+  std::vector<uint8_t> registered_fds_;
 
   std::map<int, epoll_event> pending_add_fds_;
   std::vector<int> pending_del_fds_;
 
   std::vector<std::function<void()>> pending_tasks_;
 
+  // tasks posted by other threads when use_lock_free is on, no mutex needed
+  MpscQueue<TaskNode> task_queue_;
+  bool use_lock_free_{false};
+
+  // tasks added by loop thread itself, only touched by loop thread
+  std::vector<std::function<void()>> loop_tasks_;
+
+  // buffer of epoll_wait, doubled when epoll_wait returns a full batch, until reactor.max_epoll_events
+  std::vector<epoll_event> epoll_events_;
+
+  std::atomic<uint64_t> loop_count_{0};
+  std::atomic<uint64_t> event_count_{0};
+  std::atomic<uint64_t> full_batch_count_{0};
+  std::atomic<uint64_t> wait_time_us_{0};
+  std::atomic<int> batch_size_{0};  // size of epoll_events_, readable by other threads
+  std::atomic<uint64_t> wakeup_count_{0};
+
+  int busy_poll_max_us_{-1};  // -1 means use reactor.busy_poll_us
+  int busy_poll_us_{0};       // budget of next busy poll, halved when idle
+
   Timer *timer_{nullptr};
 
+  // completions are reaped when its fd is readable in epoll, submitted before each epoll_wait
+  IoUring *io_uring_{nullptr};
+
   ReactorType type_{ReactorType::SubReactor};
 };
 
+/**
+ * @brief IO 线程间共享的协程任务队列，每个 IO 线程一个 Chase-Lev 工作窃取队列
+ *
+ * 只有 IO 线程自己会向自己的队列 Push 和 Pop，空闲的 IO 线程随机选择其他线程窃取一半任务
+ */
 class CoroutineTaskQueue {
  public:
   static auto GetCoroutineTaskQueue() -> CoroutineTaskQueue *;
 
   CoroutineTaskQueue();
 
+  /**
+   * @brief 只能由 thread_idx 对应的 IO 线程调用
+   */
   void Push(int thread_idx, FdEvent *fd);
 
   /**
-   * @brief Try to pop a FdEvent, if empty, return nullptr
+   * @brief Try to pop a FdEvent, if empty, return nullptr. only called by io thread of thread_idx
    *
    * @param thread_idx
    * @return FdEvent*
    */
-  auto PopSome(int thread_idx, int pop_cnt) -> std::vector<FdEvent *>;
+  auto Pop(int thread_idx) -> FdEvent *;
 
   bool Empty(int thread_idx);
 
   /**
-   * @brief Steal some tasks from other threads.
+   * @brief Steal about half of tasks from a random victim thread, at most steal_cnt.
    *
    * @param thread_idx
-   * @return int task count steal successfully
+   * @return tasks steal successfully
    */
   std::vector<FdEvent *> Steal(int thread_idx, int steal_cnt);
 
  private:
-  std::vector<std::queue<FdEvent *>> tasks_;
-  std::vector<Mutex> mutexs_;
+  std::vector<std::unique_ptr<WorkStealDeque<FdEvent *>>> tasks_;
 };
 
 }  // namespace tirpc
\ No newline at end of file
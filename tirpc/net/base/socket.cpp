@@ -62,6 +62,14 @@ bool Socket::Connect(const Address::ptr addr, uint64_t timeout_ms) {
 
 bool Socket::IsValid() { return fd_ != -1; }
 
+bool Socket::SetReusePort() {
+  if (!IsValid()) {
+    NewSock();
+  }
+  int val = 1;
+  return SetOption(SOL_SOCKET, SO_REUSEPORT, val);
+}
+
 bool Socket::Listen(int backlog) { return ::listen(fd_, backlog); }
 
 void Socket::Close() {}
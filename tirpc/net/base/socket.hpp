@@ -28,6 +28,11 @@ class Socket : public std::enable_shared_from_this<Socket> {
 
   bool Listen(int backlog = SOMAXCONN);
 
+  /**
+   * @brief 设置 SO_REUSEPORT，需要在 Bind 之前调用，多个设置了它的 socket 可以监听同一个端口，由内核分发连接
+   */
+  bool SetReusePort();
+
   void Close();
 
   bool GetOption(int level, int option, void *result, socklen_t *len);
@@ -1,29 +1,78 @@
-
 #include "tirpc/net/base/timer.hpp"
 
 #include <asm-generic/errno-base.h>
-#include <sys/time.h>
 #include <sys/timerfd.h>
+#include <algorithm>
 #include <cassert>
+#include <climits>
 #include <cstdint>
 #include <cstring>
 #include <ctime>
 #include <functional>
-#include <map>
 #include <vector>
 
+#include "tirpc/common/config.hpp"
 #include "tirpc/common/log.hpp"
-#include "tirpc/common/mutex.hpp"
 #include "tirpc/coroutine/coroutine_hook.hpp"
+#include "tirpc/net/base/reactor.hpp"
 
 extern read_fun_ptr_t g_sys_read_fun;
 
 namespace tirpc {
 
+static ConfigVar<bool>::ptr g_coarse_clock = Config::Lookup(
+    "reactor.coarse_clock", false, "refresh cached time of loop by CLOCK_MONOTONIC_COARSE, cheaper but of tick resolution");
+
+static thread_local bool t_now_ms_cached = false;
+static thread_local int64_t t_now_ms = 0;
+static thread_local clockid_t t_clock_id = CLOCK_MONOTONIC;
+
+static auto ReadClockMs(clockid_t clock_id) -> int64_t {
+  timespec ts;
+  clock_gettime(clock_id, &ts);
+  return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
 auto GetNowMs() -> int64_t {
-  struct timeval tv;
-  gettimeofday(&tv, nullptr);
-  return tv.tv_sec * 1000 + tv.tv_usec / 1000;
+  if (t_now_ms_cached) {
+    return t_now_ms;
+  }
+  return ReadClockMs(CLOCK_MONOTONIC);
+}
+
+void SetNowMsCached(bool cached) {
+  // COARSE shares the epoch of MONOTONIC, ticks of both can be compared and armed to timerfd
+  t_clock_id = cached && g_coarse_clock->GetValue() ? CLOCK_MONOTONIC_COARSE : CLOCK_MONOTONIC;
+  t_now_ms_cached = cached;
+  UpdateNowMs();
+}
+
+void UpdateNowMs() { t_now_ms = ReadClockMs(t_clock_id); }
+
+/**
+ * @brief 从 cur 的下一个槽开始环形查找第一个非空槽，返回它到 cur 的距离 [1, slots]，没有非空槽返回 -1
+ */
+template <size_t N>
+static auto NextSlotDistance(const std::array<uint64_t, N> &bitmap, int cur) -> int {
+  constexpr int slots = static_cast<int>(N * 64);
+  int start = (cur + 1) & (slots - 1);
+  int start_word = start >> 6;
+  int start_bit = start & 63;
+  // the start word is visited twice, bits after start first and bits before start at last
+  for (size_t i = 0; i <= N; ++i) {
+    size_t word = (start_word + i) % N;
+    uint64_t bits = bitmap[word];
+    if (i == 0) {
+      bits &= ~uint64_t{0} << start_bit;
+    } else if (i == N) {
+      bits &= start_bit == 0 ? 0 : (uint64_t{1} << start_bit) - 1;
+    }
+    if (bits != 0) {
+      int slot = static_cast<int>(word * 64) + __builtin_ctzll(bits);
+      return ((slot - cur - 1) & (slots - 1)) + 1;
+    }
+  }
+  return -1;
 }
 
 Timer::Timer(Reactor *reactor) : FdEvent(reactor) {
@@ -32,6 +81,8 @@ Timer::Timer(Reactor *reactor) : FdEvent(reactor) {
   if (fd_ == -1) {
     LOG_ERROR << "timerfd_create error";
   }
+  cur_tick_ = GetNowMs();
+  armed_tick_ = INT64_MAX;
   read_callback_ = std::bind(&Timer::OnTimer, this);
   AddListenEvents(READ);
 }
@@ -39,123 +90,275 @@ Timer::Timer(Reactor *reactor) : FdEvent(reactor) {
 Timer::~Timer() {
   UnregisterFromReactor();
   close(fd_);
+  while (PendingEvent *node = pending_events_.Pop()) {
+    delete node;
+  }
+  ClearWheels();
 }
 
+auto Timer::IsLoopThread() const -> bool { return reactor_ == nullptr || reactor_->GetTid() == GetTid(); }
+
 void Timer::AddTimerEvent(TimerEvent::ptr event, bool need_reset) {
-  RWMutex::WriteLocker lock(mutex_);
-  bool is_reset = false;
-  if (pending_events_.empty()) {
-    is_reset = true;
-  } else {
-    auto it = pending_events_.begin();
-    if (event->arrive_time_ < it->second->arrive_time_) {
-      is_reset = true;
+  if (IsLoopThread()) {
+    AddInLoopThread(std::move(event), need_reset);
+    return;
+  }
+  auto *node = new PendingEvent();
+  node->event_ = std::move(event);
+  node->is_add_ = true;
+  node->need_reset_ = need_reset;
+  pending_events_.Push(node);
+  reactor_->Wakeup();
+}
+
+void Timer::DelTimerEvent(TimerEvent::ptr event) {
+  event->is_canceled_ = true;
+  if (IsLoopThread()) {
+    DelInLoopThread(event);
+    return;
+  }
+  auto *node = new PendingEvent();
+  node->event_ = std::move(event);
+  node->is_add_ = false;
+  pending_events_.Push(node);
+  reactor_->Wakeup();
+}
+
+void Timer::HandlePendingEvents() {
+  while (PendingEvent *node = pending_events_.Pop()) {
+    if (node->is_add_) {
+      AddInLoopThread(std::move(node->event_), node->need_reset_);
+    } else {
+      DelInLoopThread(node->event_);
     }
+    delete node;
   }
-  pending_events_.emplace(event->arrive_time_, event);
-  lock.Unlock();
+}
 
-  if (is_reset && need_reset) {
+void Timer::AddInLoopThread(TimerEvent::ptr event, bool need_reset) {
+  if (event->timer_ == this) {
+    // add again, move it to new arrive time
+    Unlink(event.get());
+  }
+  if (event_count_ == 0) {
+    // nothing is linked, skip the idle ticks at once
+    cur_tick_ = std::max(cur_tick_, GetNowMs());
+  }
+  int64_t tick = std::max(event->arrive_time_, cur_tick_ + 1);
+  int64_t wake_tick = Link(std::move(event), tick);
+
+  if (need_reset && wake_tick < armed_tick_) {
     LOG_DEBUG << "need reset timer";
-    ResetArriveTime();
+    ArmAt(wake_tick);
   }
 }
 
-void Timer::DelTimerEvent(TimerEvent::ptr event) {
-  event->is_canceled_ = true;
+void Timer::DelInLoopThread(const TimerEvent::ptr &event) {
+  if (event->timer_ != this) {
+    return;
+  }
+  Unlink(event.get());
+}
 
-  RWMutex::WriteLocker lock(mutex_);
-  auto begin = pending_events_.lower_bound(event->arrive_time_);
-  auto end = pending_events_.upper_bound(event->arrive_time_);
-  auto it = begin;
-  for (; it != end; it++) {
-    if (it->second == event) {
-      LOG_DEBUG << "find timer event, now delete it. src arrive time=" << event->arrive_time_;
-      break;
+auto Timer::Link(TimerEvent::ptr event, int64_t tick) -> int64_t {
+  int64_t delta = tick - cur_tick_;
+  int level = 0;
+  while (level < kLevels - 1 && delta >= (int64_t{1} << (kSlotBits * (level + 1)))) {
+    ++level;
+  }
+  int64_t max_delta = (int64_t{1} << (kSlotBits * kLevels)) - 1;
+  if (delta > max_delta) {
+    // beyond the top wheel, park it in the farthest slot, it's linked again by its real tick when cascaded
+    tick = cur_tick_ + max_delta;
+  }
+  int shift = level * kSlotBits;
+  int slot = static_cast<int>((tick >> shift) & kSlotMask);
+
+  Wheel &wheel = wheels_[level];
+  event->timer_ = this;
+  event->level_ = level;
+  event->slot_ = slot;
+  event->prev_ = nullptr;
+  event->next_ = std::move(wheel.slots_[slot]);
+  if (event->next_ != nullptr) {
+    event->next_->prev_ = event.get();
+  }
+  wheel.slots_[slot] = std::move(event);
+  wheel.bitmap_[slot >> 6] |= uint64_t{1} << (slot & 63);
+  ++event_count_;
+
+  return (tick >> shift) << shift;
+}
+
+void Timer::Unlink(TimerEvent *event) {
+  // caller holds a reference of event, it's safe to drop the one of slot
+  Wheel &wheel = wheels_[event->level_];
+  int slot = event->slot_;
+  TimerEvent *prev = event->prev_;
+  TimerEvent::ptr next = std::move(event->next_);
+  event->prev_ = nullptr;
+  event->timer_ = nullptr;
+  if (next != nullptr) {
+    next->prev_ = prev;
+  }
+  if (prev != nullptr) {
+    prev->next_ = std::move(next);
+  } else {
+    wheel.slots_[slot] = std::move(next);
+    if (wheel.slots_[slot] == nullptr) {
+      wheel.bitmap_[slot >> 6] &= ~(uint64_t{1} << (slot & 63));
     }
   }
-  if (it != pending_events_.end()) {
-    pending_events_.erase(it);
+  --event_count_;
+}
+
+void Timer::Cascade(int level, int slot) {
+  Wheel &wheel = wheels_[level];
+  TimerEvent::ptr event = std::move(wheel.slots_[slot]);
+  wheel.bitmap_[slot >> 6] &= ~(uint64_t{1} << (slot & 63));
+  while (event != nullptr) {
+    TimerEvent::ptr next = std::move(event->next_);
+    event->prev_ = nullptr;
+    event->timer_ = nullptr;
+    --event_count_;
+    int64_t tick = std::max(event->arrive_time_, cur_tick_);
+    Link(std::move(event), tick);
+    event = std::move(next);
   }
-  lock.Unlock();
-  LOG_DEBUG << "del timer event succ, origin arrive time=" << event->arrive_time_;
 }
 
-void Timer::ResetArriveTime() {
-  RWMutex::ReadLocker lock(mutex_);
-  std::multimap<int64_t, TimerEvent::ptr> tmp = pending_events_;
-  lock.Unlock();
+void Timer::Advance(int64_t now, std::vector<TimerEvent::ptr> &expired) {
+  while (cur_tick_ < now) {
+    int64_t next = NextTick();
+    if (next > now) {
+      // no slot to handle in (cur_tick_, now], jump over the empty ticks
+      cur_tick_ = now;
+      break;
+    }
+    cur_tick_ = next;
 
-  if (tmp.empty()) {
-    LOG_DEBUG << "no timer event, return";
-    return;
+    // slots of upper wheels which start at this tick move down, from lower level to upper level
+    for (int level = 1; level < kLevels; ++level) {
+      int shift = level * kSlotBits;
+      if ((cur_tick_ & ((int64_t{1} << shift) - 1)) != 0) {
+        break;
+      }
+      Cascade(level, static_cast<int>((cur_tick_ >> shift) & kSlotMask));
+    }
+
+    int slot = static_cast<int>(cur_tick_ & kSlotMask);
+    Wheel &wheel = wheels_[0];
+    TimerEvent::ptr event = std::move(wheel.slots_[slot]);
+    wheel.bitmap_[slot >> 6] &= ~(uint64_t{1} << (slot & 63));
+    while (event != nullptr) {
+      TimerEvent::ptr next = std::move(event->next_);
+      event->prev_ = nullptr;
+      event->timer_ = nullptr;
+      --event_count_;
+      expired.push_back(std::move(event));
+      event = std::move(next);
+    }
   }
+}
 
-  int64_t now = GetNowMs();
-  auto it = tmp.rbegin();
-  if (it->first < now) {
-    LOG_DEBUG << "all timer events have expired, now=" << now << ", last=" << it->first;
-    return;
+auto Timer::NextTick() const -> int64_t {
+  if (event_count_ == 0) {
+    return INT64_MAX;
+  }
+  int64_t next = INT64_MAX;
+  for (int level = 0; level < kLevels; ++level) {
+    int shift = level * kSlotBits;
+    int cur = static_cast<int>((cur_tick_ >> shift) & kSlotMask);
+    int distance = NextSlotDistance(wheels_[level].bitmap_, cur);
+    if (distance < 0) {
+      continue;
+    }
+    // level 0 holds ticks in (cur_tick_, cur_tick_ + 256), upper levels wake up at start of the slot to cascade
+    int64_t tick = level == 0 ? cur_tick_ + distance : ((cur_tick_ >> shift) + distance) << shift;
+    next = std::min(next, tick);
   }
-  int64_t interval = it->first - now;
+  return next;
+}
+
+void Timer::ArmAt(int64_t tick) {
+  armed_tick_ = tick;
 
+  // ticks are CLOCK_MONOTONIC ms, arm by absolute time so cached now isn't needed. a past tick fires at once
   itimerspec new_value;
   bzero(&new_value, sizeof(new_value));
+  new_value.it_value.tv_sec = tick / 1000;
+  new_value.it_value.tv_nsec = (tick % 1000) * 1000000;
 
-  timespec ts;
-  bzero(&ts, sizeof(ts));
-
-  ts.tv_sec = interval / 1000;
-  ts.tv_nsec = (interval % 1000) * 1000000;
-  new_value.it_value = ts;
-
-  int rt = timerfd_settime(fd_, 0, &new_value, nullptr);
-
+  int rt = timerfd_settime(fd_, TFD_TIMER_ABSTIME, &new_value, nullptr);
   if (rt != 0) {
-    LOG_ERROR << "timerfd_settime error, interval=" << interval;
+    LOG_ERROR << "timerfd_settime error, tick=" << tick;
   }
 }
 
+void Timer::ResetArriveTime() {
+  int64_t next = NextTick();
+  if (next == INT64_MAX) {
+    LOG_DEBUG << "no timer event, return";
+    armed_tick_ = INT64_MAX;
+    return;
+  }
+  ArmAt(next);
+}
+
 void Timer::OnTimer() {
   // 把定时器文件描述符读干净
   char buf[8];
+  bool expired = false;
   while (true) {
-    if ((g_sys_read_fun(fd_, buf, 8) == -1) && errno == EAGAIN) {
+    ssize_t rt = g_sys_read_fun(fd_, buf, 8);
+    if (rt == -1 && errno == EAGAIN) {
       break;
     }
+    expired = expired || rt > 0;
   }
-
-  // 取出到期并未取消的事件
   int64_t now = GetNowMs();
-  RWMutex::WriteLocker lock(mutex_);
-  std::vector<TimerEvent::ptr> repeated_tasks;
-  std::vector<std::function<void()>> tasks;
-
-  auto it = pending_events_.begin();
-  for (; it != pending_events_.end(); ++it) {
-    if (it->first > now || it->second->is_canceled_) {
-      break;
-    }
-    if (it->second->is_repeated_) {
-      repeated_tasks.push_back(it->second);
-    }
-    tasks.emplace_back(it->second->task_);
+  if (expired && armed_tick_ != INT64_MAX) {
+    // armed tick has passed, even if the cached coarse clock hasn't reached it yet
+    now = std::max(now, armed_tick_);
   }
+  HandlePendingEvents();
 
-  pending_events_.erase(pending_events_.begin(), it);
-  lock.Unlock();
+  // 取出到期的事件，取消的事件已经从时间轮上摘掉了
+  std::vector<TimerEvent::ptr> tasks;
+  Advance(now, tasks);
 
-  for (auto &task : repeated_tasks) {
-    // LOG_DEBUG << "excute timer event on " << (*i)->m_arrive_time;
-    task->Reset();
-    AddTimerEvent(task, false);
+  for (auto &task : tasks) {
+    if (task->is_repeated_ && !task->is_canceled_) {
+      task->Reset();
+      AddInLoopThread(task, false);
+    }
   }
 
   ResetArriveTime();
 
   for (const auto &task : tasks) {
-    task();
+    // an earlier task may resume a coroutine which cancels this event
+    if (!task->is_canceled_) {
+      task->task_();
+    }
+  }
+}
+
+void Timer::ClearWheels() {
+  // unlink one by one, a long chain of next_ would be destroyed recursively
+  for (auto &wheel : wheels_) {
+    for (auto &head : wheel.slots_) {
+      TimerEvent::ptr event = std::move(head);
+      while (event != nullptr) {
+        TimerEvent::ptr next = std::move(event->next_);
+        event->prev_ = nullptr;
+        event->timer_ = nullptr;
+        event = std::move(next);
+      }
+    }
+    wheel.bitmap_.fill(0);
   }
+  event_count_ = 0;
 }
 
-}  // namespace tirpc
\ No newline at end of file
+}  // namespace tirpc
@@ -1,17 +1,38 @@
 #pragma once
 
 #include "tirpc/common/log.hpp"
+#include "tirpc/common/mpsc_queue.hpp"
 #include "tirpc/common/mutex.hpp"
 #include "tirpc/net/base/fd_event.hpp"
 
-#include <map>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <functional>
 #include <memory>
 #include <utility>
+#include <vector>
 
 namespace tirpc {
 
+/**
+ * @brief 当前单调时钟的毫秒数，不受系统时间调整影响
+ * 开启缓存的线程（reactor loop 线程）返回每轮循环刷新一次的缓存值，其他线程直接读 CLOCK_MONOTONIC
+ */
 auto GetNowMs() -> int64_t;
 
+/**
+ * @brief 设置当前线程是否使用缓存的时间，由 Reactor::Loop 开始时开启，退出时关闭
+ */
+void SetNowMsCached(bool cached);
+
+/**
+ * @brief 刷新当前线程缓存的时间，由 Reactor::Loop 每轮调用
+ */
+void UpdateNowMs();
+
+class Timer;
+
 /**
  * @brief 定时事件封装，记录任务是否重复、是否取消，以及创建时间等信息
  *
@@ -22,8 +43,8 @@ class TimerEvent {
 
   TimerEvent(int64_t interval, bool is_repeated, std::function<void()> task)
       : interval_(interval), is_repeated_(is_repeated), task_(std::move(task)) {
+    // every rpc call and connect creates one, keep it free of logging
     arrive_time_ = GetNowMs() + interval_;
-    LOG_DEBUG << "timeevent will occur at " << arrive_time_;
   }
 
   void Reset() {
@@ -45,12 +66,24 @@ class TimerEvent {
   bool is_canceled_{false};
 
   std::function<void()> task_;
+
+ private:
+  friend class Timer;
+
+  // intrusive links of a slot in timing wheel, the slot owns events by next_, so cancel is O(1)
+  TimerEvent::ptr next_{nullptr};
+  TimerEvent *prev_{nullptr};
+  Timer *timer_{nullptr};  // timer it's linked in, only touched by loop thread of that timer
+  int level_{0};
+  int slot_{0};
 };
 
 /**
  * @brief 定时器，用于处理定时任务
  * Timer::OnTimer 被设置为 read_callback_
  *
+ * 定时事件保存在分层时间轮中，精度 1ms，共 4 层，每层 256 个槽，插入和删除都是 O(1)。
+ * 时间轮只由所属 Reactor 的 loop 线程访问，不加锁；其他线程添加或删除的事件先放入无锁队列，由 loop 线程合并
  */
 class Timer : public FdEvent {
  public:
@@ -64,19 +97,95 @@ class Timer : public FdEvent {
 
   void DelTimerEvent(TimerEvent::ptr event);
 
+  /**
+   * @brief 按时间轮中最早的事件重新设置 timerfd
+   */
   void ResetArriveTime();
 
   /**
    * @brief 处理定时器事件，当定时器触发时被调用。
-   * 该函数会读取定时器文件描述符的数据，找出所有已到期且未被取消的定时器事件，
+   * 该函数会读取定时器文件描述符的数据，推进时间轮取出所有已到期且未被取消的定时器事件，
    * 处理这些事件（包括重复执行的事件），重置定时器的到达时间，并执行到期事件的任务。
    */
   void OnTimer();
 
+  /**
+   * @brief 合并其他线程添加或删除的事件，由 loop 线程在每轮循环调用
+   */
+  void HandlePendingEvents();
+
+  /**
+   * @brief 是否有其他线程添加或删除的事件还没合并，只能由 loop 线程调用
+   */
+  auto HasPendingEvents() const -> bool { return !pending_events_.Empty(); }
+
+ private:
+  static constexpr int kLevels = 4;
+  static constexpr int kSlotBits = 8;
+  static constexpr int kSlots = 1 << kSlotBits;
+  static constexpr int kSlotMask = kSlots - 1;
+
+  /**
+   * @brief 其他线程对时间轮的一次修改
+   */
+  struct PendingEvent {
+    std::atomic<PendingEvent *> next_{nullptr};
+    TimerEvent::ptr event_;
+    bool is_add_{true};
+    bool need_reset_{true};
+  };
+
+  struct Wheel {
+    std::array<TimerEvent::ptr, kSlots> slots_;
+    std::array<uint64_t, kSlots / 64> bitmap_{};  // bit is set when slot isn't empty
+  };
+
+  auto IsLoopThread() const -> bool;
+
+  void AddInLoopThread(TimerEvent::ptr event, bool need_reset);
+
+  void DelInLoopThread(const TimerEvent::ptr &event);
+
+  /**
+   * @brief 按到期 tick 把事件挂到对应层的槽上，tick 不能早于 cur_tick_
+   *
+   * @return loop 需要被唤醒来处理这个槽的 tick，第 0 层就是到期 tick，更高层是这个槽降层的 tick
+   */
+  auto Link(TimerEvent::ptr event, int64_t tick) -> int64_t;
+
+  void Unlink(TimerEvent *event);
+
+  /**
+   * @brief 把时间推进到 now，到期的事件从时间轮上摘下放入 expired
+   */
+  void Advance(int64_t now, std::vector<TimerEvent::ptr> &expired);
+
+  /**
+   * @brief 把 level 层的 slot 槽中的事件重新插入到更低的层
+   */
+  void Cascade(int level, int slot);
+
+  /**
+   * @brief 时间轮中下一个需要处理的 tick（事件到期或者需要降层），没有事件时返回 INT64_MAX
+   */
+  auto NextTick() const -> int64_t;
+
+  /**
+   * @brief 设置 timerfd 在 tick 到期
+   */
+  void ArmAt(int64_t tick);
+
+  void ClearWheels();
+
  private:
-  std::multimap<int64_t, TimerEvent::ptr> pending_events_;
+  std::array<Wheel, kLevels> wheels_;
+
+  int64_t cur_tick_{0};    // ms, all ticks before and equal to it have been handled
+  int64_t armed_tick_{0};  // tick timerfd is set to expire, INT64_MAX if it's not set
+  size_t event_count_{0};  // events linked in wheels
 
-  RWMutex mutex_;
+  // events added or deleted by other threads
+  MpscQueue<PendingEvent> pending_events_;
 };
 
-}  // namespace tirpc
\ No newline at end of file
+}  // namespace tirpc
@@ -20,6 +20,8 @@ class HttpCodeC : public AbstractCodeC {
 
   auto GenDataPtr() -> AbstractData::ptr override;
 
+  auto Clone() -> AbstractCodeC::ptr override { return std::make_shared<HttpCodeC>(); }
+
  private:
   auto ParseHttpRequestLine(HttpRequest *requset, std::string_view tmp) -> bool;
   auto ParseHttpRequestHeader(HttpRequest *requset, std::string_view tmp) -> bool;
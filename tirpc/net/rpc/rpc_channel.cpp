@@ -5,6 +5,7 @@
 #include <google/protobuf/service.h>
 #include <memory>
 
+#include "tirpc/common/config.hpp"
 #include "tirpc/common/error_code.hpp"
 #include "tirpc/common/log.hpp"
 #include "tirpc/common/msg_req.hpp"
@@ -16,6 +17,9 @@
 
 namespace tirpc {
 
+static ConfigVar<bool>::ptr g_client_conn_pool =
+    Config::Lookup("client.conn_pool", true, "whether RpcChannel reuses pooled connections");
+
 RpcChannel::RpcChannel(Address::ptr addr) {
   addrs_.clear();
   addrs_.push_back(addr);
@@ -88,7 +92,10 @@ void RpcChannel::CallMethod(const google::protobuf::MethodDescriptor *method,
     }
 
     addr = load_balancer_->select(addrs_, pb_struct);
-    TcpClient::ptr client = std::make_shared<TcpClient>(addr);
+    bool use_pool = g_client_conn_pool->GetValue();
+    TcpClient::ptr client =
+        use_pool ? TcpClientPool::GetTcpClientPool()->GetClient(addr) : std::make_shared<TcpClient>(addr);
+    std::string msg_no = client->PrepareTinyPb(pb_struct);
     rpc_controller->SetLocalAddr(client->GetLocalAddr());
     rpc_controller->SetPeerAddr(client->GetPeerAddr());
 
@@ -105,10 +112,13 @@ void RpcChannel::CallMethod(const google::protobuf::MethodDescriptor *method,
     int64_t res_time = end_call - GetNowMs();
     client->SetTimeout(res_time);
 
-    int ret = client->SendAndRecvTinyPb(pb_struct.msg_seq_, res_data);
+    int ret = client->SendAndRecvTinyPb(msg_no, res_data, response);
     if (ret == 0) {
       break;
-    } else if (ret != ERROR_RPC_CALL_TIMEOUT) {
+    } else if (ret != ERROR_RPC_CALL_TIMEOUT && ret != ERROR_FAILED_DESERIALIZE) {
+      if (use_pool) {
+        TcpClientPool::GetTcpClientPool()->RemoveClient(addr, client);
+      }
       auto it = addrs_.begin();
       for (; it != addrs_.end(); it++) {
         if ((*it)->ToString() == addr->ToString()) {
@@ -132,11 +142,17 @@ void RpcChannel::CallMethod(const google::protobuf::MethodDescriptor *method,
     }
   }
 
-  if (!response->ParseFromString(res_data->pb_data_)) {
-    rpc_controller->SetError(ERROR_FAILED_DESERIALIZE, "failed to deserialize data from server");
-    LOG_ERROR << pb_struct.msg_seq_ << "|failed to deserialize data";
+  if (!res_data) {
+    // every retry failed with client error
+    rpc_controller->SetError(ERROR_FAILED_GET_REPLY, "failed to get server reply after retry");
+    LOG_ERROR << pb_struct.msg_seq_ << "|call rpc failed after " << max_retry << " retries, serviceFullName="
+              << pb_struct.service_full_name_;
+    if (done) {
+      done->Run();
+    }
     return;
   }
+
   if (res_data->err_code_ != 0) {
     LOG_ERROR << pb_struct.msg_seq_ << "|server reply error_code=" << res_data->err_code_
              << ", err_info=" << res_data->err_info_;
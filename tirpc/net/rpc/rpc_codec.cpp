@@ -1,9 +1,11 @@
 #include "tirpc/net/rpc/rpc_codec.hpp"
 
+#include <google/protobuf/message.h>
 #include <cstring>
 #include <memory>
 #include <vector>
 
+#include "tirpc/common/config.hpp"
 #include "tirpc/common/log.hpp"
 #include "tirpc/common/msg_req.hpp"
 #include "tirpc/net/base/byte.hpp"
@@ -13,11 +15,34 @@
 
 namespace tirpc {
 
-static const char PB_START = 0x02;  // start char
-static const char PB_END = 0x03;    // end char
+static const char PB_START = 0x02;     // start char
+static const char PB_END = 0x03;       // end char
+static const char PB_START_V2 = 0x04;  // start char of v2 package
+
+// start + pk_len + msg_req_len + service_name_len + err_code + err_info_len + check_num + end
+static const int PB_V1_MIN_LEN = 2 * sizeof(char) + 6 * sizeof(int32_t);
+
+// start + pk_len + msg_id + method_id + err_code + err_info_len
+static const int PB_V2_HEADER_LEN = sizeof(char) + sizeof(int32_t) + sizeof(uint64_t) + 3 * sizeof(int32_t);
 // static const int MSG_REQ_LEN = 20;  // default length of msg_req
 
-TinyPbCodeC::TinyPbCodeC() = default;
+static ConfigVar<int>::ptr g_max_pk_len = Config::Lookup(
+    "tinypb.max_pk_len", 16 * 1024 * 1024, "max length of one TinyPb package, bigger pk_len is taken as broken header");
+
+// len of business data, serialized size of pb_msg_ is cached for WritePbData
+static auto GetPbDataLen(TinyPbStruct *data) -> int {
+  if (data->pb_msg_ == nullptr) {
+    return data->pb_data_.length();
+  }
+  size_t size = data->pb_msg_->ByteSizeLong();
+  if (size > static_cast<size_t>(INT32_MAX / 2)) {
+    LOG_ERROR << "encode error, pb data too large, size = " << size;
+    return -1;
+  }
+  return static_cast<int>(size);
+}
+
+TinyPbCodeC::TinyPbCodeC() : max_pk_len_(g_max_pk_len->GetValue()) {}
 
 TinyPbCodeC::~TinyPbCodeC() = default;
 
@@ -29,31 +54,31 @@ void TinyPbCodeC::Encode(TcpBuffer *buf, AbstractData *data) {
   // LOG_DEBUG << "test encode start";
   auto *tmp = dynamic_cast<TinyPbStruct *>(data);
 
-  int len = 0;
-  const char *re = EncodePbData(tmp, len);
-  if (re == nullptr || len == 0 || !tmp->encode_succ_) {
+  int len = tmp->version_ == TinyPb_V2 ? EncodePbDataV2(tmp, buf) : EncodePbData(tmp, buf);
+  if (len == 0 || !tmp->encode_succ_) {
     LOG_ERROR << "encode error";
     data->encode_succ_ = false;
     return;
   }
-  LOG_DEBUG << "encode package len = " << len;
-  if (buf != nullptr) {
-    buf->WriteToBuffer(re, len);
-    LOG_DEBUG << "succ encode and write to buffer, writeindex=" << buf->WriteIndex();
-  }
-  data = tmp;
-  if (re != nullptr) {
-    free(reinterpret_cast<void *>(const_cast<char *>(re)));
-    re = nullptr;
-  }
+  LOG_DEBUG << "succ encode and write to buffer, package len = " << len << ", writeindex=" << buf->WriteIndex();
   // LOG_DEBUG << "test encode end";
 }
 
-auto TinyPbCodeC::EncodePbData(TinyPbStruct *data, int &len) -> const char * {
+auto TinyPbCodeC::WritePbData(TinyPbStruct *data, char *dst, int pb_data_len) -> bool {
+  if (data->pb_msg_ == nullptr) {
+    memcpy(dst, (data->pb_data_).data(), pb_data_len);
+    return true;
+  }
+  // size has been cached by ByteSizeLong when compute pk_len
+  auto *end = data->pb_msg_->SerializeWithCachedSizesToArray(reinterpret_cast<uint8_t *>(dst));
+  return end == reinterpret_cast<uint8_t *>(dst) + pb_data_len;
+}
+
+auto TinyPbCodeC::EncodePbData(TinyPbStruct *data, TcpBuffer *out) -> int {
   if (data->service_full_name_.empty()) {
     LOG_ERROR << "parse error, service_full_name_ is empty";
     data->encode_succ_ = false;
-    return nullptr;
+    return 0;
   }
   if (data->msg_seq_.empty()) {
     data->msg_seq_ = MsgReqUtil::GenMsgNumber();
@@ -61,12 +86,16 @@ auto TinyPbCodeC::EncodePbData(TinyPbStruct *data, int &len) -> const char * {
     LOG_DEBUG << "generate msgno = " << data->msg_seq_;
   }
 
-  int32_t pk_len = 2 * sizeof(char) + 6 * sizeof(int32_t) + data->pb_data_.length() +
-                   data->service_full_name_.length() + data->msg_seq_.length() + data->err_info_.length();
+  int pb_data_len = GetPbDataLen(data);
+  if (pb_data_len < 0) {
+    data->encode_succ_ = false;
+    return 0;
+  }
+  int32_t pk_len = 2 * sizeof(char) + 6 * sizeof(int32_t) + pb_data_len + data->service_full_name_.length() +
+                   data->msg_seq_.length() + data->err_info_.length();
 
   LOG_DEBUG << "encode pk_len = " << pk_len;
-  char *buf = reinterpret_cast<char *>(malloc(pk_len));
-  char *tmp = buf;
+  char *tmp = out->ReserveWrite(pk_len);
   *tmp = PB_START;
   tmp++;
 
@@ -113,9 +142,13 @@ auto TinyPbCodeC::EncodePbData(TinyPbStruct *data, int &len) -> const char * {
     tmp += err_info_len;
   }
 
-  memcpy(tmp, (data->pb_data_).data(), data->pb_data_.length());
-  tmp += data->pb_data_.length();
-  LOG_DEBUG << "pb_data_len= " << data->pb_data_.length();
+  if (!WritePbData(data, tmp, pb_data_len)) {
+    LOG_ERROR << "encode error, failed to serialize pb data";
+    data->encode_succ_ = false;
+    return 0;
+  }
+  tmp += pb_data_len;
+  LOG_DEBUG << "pb_data_len= " << pb_data_len;
 
   int32_t checksum = 1;
   int32_t checksum_net = htonl(checksum);
@@ -133,9 +166,71 @@ auto TinyPbCodeC::EncodePbData(TinyPbStruct *data, int &len) -> const char * {
   data->check_num_ = checksum;
   data->encode_succ_ = true;
 
-  len = pk_len;
+  out->RecycleWrite(pk_len);
+  return pk_len;
+}
+
+auto TinyPbCodeC::EncodePbDataV2(TinyPbStruct *data, TcpBuffer *out) -> int {
+  // error reply echoes method_id of request, which may be 0 when peer sends an invalid one
+  if (data->method_id_ == 0 && data->err_code_ == 0) {
+    LOG_ERROR << "encode error, method_id_ of v2 package is 0";
+    data->encode_succ_ = false;
+    return 0;
+  }
+
+  int pb_data_len = GetPbDataLen(data);
+  if (pb_data_len < 0) {
+    data->encode_succ_ = false;
+    return 0;
+  }
+  int32_t err_info_len = data->err_info_.length();
+  int32_t pk_len = PB_V2_HEADER_LEN + err_info_len + pb_data_len + sizeof(char);
+
+  LOG_DEBUG << "encode v2 pk_len = " << pk_len;
+  char *tmp = out->ReserveWrite(pk_len);
+  *tmp = PB_START_V2;
+  tmp++;
 
-  return buf;
+  int32_t pk_len_net = htonl(pk_len);
+  memcpy(tmp, &pk_len_net, sizeof(int32_t));
+  tmp += sizeof(int32_t);
+
+  uint64_t msg_id_net = htobe64(data->msg_id_);
+  memcpy(tmp, &msg_id_net, sizeof(uint64_t));
+  tmp += sizeof(uint64_t);
+
+  uint32_t method_id_net = htonl(data->method_id_);
+  memcpy(tmp, &method_id_net, sizeof(uint32_t));
+  tmp += sizeof(uint32_t);
+
+  int32_t err_code_net = htonl(data->err_code_);
+  memcpy(tmp, &err_code_net, sizeof(int32_t));
+  tmp += sizeof(int32_t);
+
+  int32_t err_info_len_net = htonl(err_info_len);
+  memcpy(tmp, &err_info_len_net, sizeof(int32_t));
+  tmp += sizeof(int32_t);
+
+  if (err_info_len != 0) {
+    memcpy(tmp, (data->err_info_).data(), err_info_len);
+    tmp += err_info_len;
+  }
+
+  if (!WritePbData(data, tmp, pb_data_len)) {
+    LOG_ERROR << "encode error, failed to serialize pb data";
+    data->encode_succ_ = false;
+    return 0;
+  }
+  tmp += pb_data_len;
+
+  *tmp = PB_END;
+
+  data->pk_len_ = pk_len;
+  data->err_info_len_ = err_info_len;
+  data->encode_succ_ = true;
+
+  out->RecycleWrite(pk_len);
+  return pk_len;
 }
 
 void TinyPbCodeC::Decode(TcpBuffer *buf, AbstractData *data) {
@@ -144,144 +239,172 @@ void TinyPbCodeC::Decode(TcpBuffer *buf, AbstractData *data) {
     return;
   }
 
-  std::vector<char> tmp = buf->GetBufferVector();
-  // int total_size = buf->readAble();
-  int start_index = buf->ReadIndex();
-  int end_index = -1;
+  auto pb_struct = dynamic_cast<TinyPbStruct *>(data);
+  pb_struct->decode_succ_ = false;
+
+  const char *pk = nullptr;
   int32_t pk_len = -1;
+  while (pk == nullptr) {
+    if (pending_pk_len_ == -1) {
+      // find start of next package, bytes before it can't be parsed any more
+      const char *begin = buf->buffer_.data() + buf->ReadIndex();
+      int readable = buf->Readable();
+      int skip = 0;
+      while (skip < readable && begin[skip] != PB_START && begin[skip] != PB_START_V2) {
+        skip++;
+      }
+      if (skip != 0) {
+        LOG_DEBUG << "drop " << skip << " bytes before pk_start";
+        buf->RecycleRead(skip, false);
+        continue;
+      }
 
-  bool parse_full_pack = false;
-
-  for (int i = start_index; i < buf->WriteIndex(); ++i) {
-    // first find start
-    if (tmp[i] == PB_START) {
-      if (i + 1 < buf->WriteIndex()) {
-        pk_len = GetInt32FromNetByte(&tmp[i + 1]);
-        LOG_DEBUG << "prase pk_len =" << pk_len;
-        int j = i + pk_len - 1;
-        LOG_DEBUG << "j =" << j << ", i=" << i;
-
-        if (j >= buf->WriteIndex()) {
-          // LOG_DEBUG << "recv package not complete, or pk_start find error, continue next parse";
-          continue;
-        }
-        if (tmp[j] == PB_END) {
-          start_index = i;
-          end_index = j;
-          // LOG_DEBUG << "parse succ, now break";
-          parse_full_pack = true;
-          break;
-        }
+      if (readable < static_cast<int>(sizeof(char) + sizeof(int32_t))) {
+        LOG_DEBUG << "recv package not complete, wait pk_len";
+        return;
+      }
+      pending_pk_len_ = GetInt32FromNetByte(begin + sizeof(char));
+      LOG_DEBUG << "prase pk_len =" << pending_pk_len_;
+      if (pending_pk_len_ < (begin[0] == PB_START_V2 ? PB_V2_HEADER_LEN + 1 : PB_V1_MIN_LEN) ||
+          pending_pk_len_ > max_pk_len_) {
+        // not a real pk_start, find next one. trusting a huge pk_len would keep buffering data for it
+        pending_pk_len_ = -1;
+        buf->RecycleRead(1, false);
+        continue;
       }
     }
-  }
 
-  if (!parse_full_pack) {
-    LOG_DEBUG << "not parse full package, return";
-    return;
+    if (buf->Readable() < pending_pk_len_) {
+      // header has been parsed, wait rest of package without rescan it
+      return;
+    }
+
+    pk_len = pending_pk_len_;
+    pending_pk_len_ = -1;
+    if (buf->buffer_[buf->ReadIndex() + pk_len - 1] != PB_END) {
+      // pk_start find error, skip it and parse again
+      LOG_DEBUG << "pk_end not match, pk_len = " << pk_len;
+      buf->RecycleRead(1, false);
+      continue;
+    }
+    pk = buf->buffer_.data() + buf->ReadIndex();
   }
 
-  buf->RecycleRead(end_index + 1 - start_index);
+  pb_struct->pk_len_ = pk_len;
+  if (pk[0] == PB_START_V2) {
+    pb_struct->decode_succ_ = DecodePbDataV2(pk, pk_len, pb_struct);
+  } else {
+    pb_struct->decode_succ_ = DecodePbDataV1(pk, pk_len, pb_struct);
+  }
+  if (pb_struct->decode_succ_) {
+    // pb data is left in buffer, it's parsed from buffer directly
+    pb_struct->pb_buf_ = buf;
+    pb_struct->pb_index_ += pk - buf->buffer_.data();
+  }
 
-  LOG_DEBUG << "read_buffer size=" << buf->GetBufferVector().size() << "rd=" << buf->ReadIndex()
-            << "wd=" << buf->WriteIndex();
+  // package is parsed in place, so recycle it at last. don't move it, pb data is still used by upper layer
+  buf->RecycleRead(pk_len, false);
 
-  // TinyPbStruct pb_struct;
-  auto pb_struct = dynamic_cast<TinyPbStruct *>(data);
-  pb_struct->pk_len_ = pk_len;
-  pb_struct->decode_succ_ = false;
+  LOG_DEBUG << "read_buffer size=" << buf->GetSize() << "rd=" << buf->ReadIndex() << "wd=" << buf->WriteIndex();
+}
 
-  int msg_req_len__index = start_index + sizeof(char) + sizeof(int32_t);
-  if (msg_req_len__index >= end_index) {
-    LOG_ERROR << "parse error, msg_req_len__index[" << msg_req_len__index << "] >= end_index[" << end_index << "]";
-    // drop this error package
-    return;
-  }
+auto TinyPbCodeC::DecodePbDataV1(const char *pk, int32_t pk_len, TinyPbStruct *data) -> bool {
+  int end_index = pk_len - 1;
 
-  pb_struct->msg_req_len_ = GetInt32FromNetByte(&tmp[msg_req_len__index]);
-  if (pb_struct->msg_req_len_ == 0) {
+  int msg_req_len__index = sizeof(char) + sizeof(int32_t);
+  data->msg_req_len_ = GetInt32FromNetByte(&pk[msg_req_len__index]);
+  if (data->msg_req_len_ == 0) {
     LOG_ERROR << "prase error, msg_req_ emptr";
-    return;
+    return false;
   }
 
-  LOG_DEBUG << "msg_req_len_= " << pb_struct->msg_req_len_;
+  LOG_DEBUG << "msg_req_len_= " << data->msg_req_len_;
   int msg_req_index = msg_req_len__index + sizeof(int32_t);
   LOG_DEBUG << "msg_req_len__index= " << msg_req_index;
 
-  char msg_req[50] = {0};
-
-  memcpy(&msg_req[0], &tmp[msg_req_index], pb_struct->msg_req_len_);
-  pb_struct->msg_seq_ = std::string(msg_req);
-  LOG_DEBUG << "msg_req_= " << pb_struct->msg_seq_;
-
-  int service_name_len_index = msg_req_index + pb_struct->msg_req_len_;
-  if (service_name_len_index >= end_index) {
+  int service_name_len_index = msg_req_index + data->msg_req_len_;
+  if (data->msg_req_len_ < 0 || data->msg_req_len_ > pk_len ||
+      service_name_len_index + static_cast<int>(sizeof(int32_t)) >= end_index) {
     LOG_ERROR << "parse error, service_name_len_index[" << service_name_len_index << "] >= end_index[" << end_index
               << "]";
     // drop this error package
-    return;
+    return false;
   }
+  data->msg_seq_.assign(&pk[msg_req_index], data->msg_req_len_);
+  LOG_DEBUG << "msg_req_= " << data->msg_seq_;
 
   LOG_DEBUG << "service_name_len_index = " << service_name_len_index;
   int service_name_index = service_name_len_index + sizeof(int32_t);
 
-  if (service_name_index >= end_index) {
-    LOG_ERROR << "parse error, service_name_index[" << service_name_index << "] >= end_index[" << end_index << "]";
-    return;
-  }
+  data->service_name_len_ = GetInt32FromNetByte(&pk[service_name_len_index]);
 
-  pb_struct->service_name_len_ = GetInt32FromNetByte(&tmp[service_name_len_index]);
-
-  if (pb_struct->service_name_len_ > pk_len) {
-    LOG_ERROR << "parse error, service_name_len[" << pb_struct->service_name_len_ << "] >= pk_len [" << pk_len << "]";
-    return;
+  int err_code_index = service_name_index + data->service_name_len_;
+  if (data->service_name_len_ < 0 || data->service_name_len_ > pk_len ||
+      err_code_index + static_cast<int>(2 * sizeof(int32_t)) >= end_index) {
+    LOG_ERROR << "parse error, service_name_len[" << data->service_name_len_ << "] >= pk_len [" << pk_len << "]";
+    return false;
   }
-  LOG_DEBUG << "service_name_len = " << pb_struct->service_name_len_;
-
-  char service_name[512] = {0};
+  LOG_DEBUG << "service_name_len = " << data->service_name_len_;
 
-  memcpy(&service_name[0], &tmp[service_name_index], pb_struct->service_name_len_);
-  pb_struct->service_full_name_ = std::string(service_name);
-  LOG_DEBUG << "service_name = " << pb_struct->service_full_name_;
+  data->service_full_name_.assign(&pk[service_name_index], data->service_name_len_);
+  LOG_DEBUG << "service_name = " << data->service_full_name_;
 
-  int err_code_index = service_name_index + pb_struct->service_name_len_;
-  pb_struct->err_code_ = GetInt32FromNetByte(&tmp[err_code_index]);
+  data->err_code_ = GetInt32FromNetByte(&pk[err_code_index]);
 
   int err_info_len_index = err_code_index + sizeof(int32_t);
+  data->err_info_len_ = GetInt32FromNetByte(&pk[err_info_len_index]);
+  LOG_DEBUG << "err_info_len = " << data->err_info_len_;
+  int err_info_index = err_info_len_index + sizeof(int32_t);
 
-  if (err_info_len_index >= end_index) {
-    LOG_ERROR << "parse error, err_info_len_index[" << err_info_len_index << "] >= end_index[" << end_index << "]";
-    // drop this error package
-    return;
+  int pb_data_len = pk_len - data->service_name_len_ - data->msg_req_len_ - data->err_info_len_ - PB_V1_MIN_LEN;
+  int pb_data_index = err_info_index + data->err_info_len_;
+  LOG_DEBUG << "pb_data_len= " << pb_data_len << ", pb_index = " << pb_data_index;
+
+  if (data->err_info_len_ < 0 || pb_data_len < 0) {
+    LOG_ERROR << "parse error, pb_data_index[" << pb_data_index << "] >= end_index[" << end_index << "]";
+    return false;
   }
-  pb_struct->err_info_len_ = GetInt32FromNetByte(&tmp[err_info_len_index]);
-  LOG_DEBUG << "err_info_len = " << pb_struct->err_info_len_;
-  int err_info_index = err_info_len_index + sizeof(int32_t);
 
-  char err_info[512] = {0};
+  data->err_info_.assign(&pk[err_info_index], data->err_info_len_);
+  data->pb_index_ = pb_data_index;
+  data->pb_data_len_ = pb_data_len;
 
-  memcpy(&err_info[0], &tmp[err_info_index], pb_struct->err_info_len_);
-  pb_struct->err_info_ = std::string(err_info);
+  // LOG_DEBUG << "decode succ,  pk_len = " << pk_len << ", service_name = " << data->service_full_name_;
+  return true;
+}
 
-  int pb_data_len = pb_struct->pk_len_ - pb_struct->service_name_len_ - pb_struct->msg_req_len_ -
-                    pb_struct->err_info_len_ - 2 * sizeof(char) - 6 * sizeof(int32_t);
+auto TinyPbCodeC::DecodePbDataV2(const char *pk, int32_t pk_len, TinyPbStruct *data) -> bool {
+  const char *tmp = pk + sizeof(char) + sizeof(int32_t);
 
-  int pb_data_index = err_info_index + pb_struct->err_info_len_;
-  LOG_DEBUG << "pb_data_len= " << pb_data_len << ", pb_index = " << pb_data_index;
+  data->version_ = TinyPb_V2;
+  data->msg_id_ = GetInt64FromNetByte(tmp);
+  tmp += sizeof(uint64_t);
 
-  if (pb_data_index >= end_index) {
-    LOG_ERROR << "parse error, pb_data_index[" << pb_data_index << "] >= end_index[" << end_index << "]";
-    return;
-  }
-  // LOG_DEBUG << "pb_data_index = " << pb_data_index << ", pb_data_.length = " << pb_data_len;
+  data->method_id_ = GetInt32FromNetByte(tmp);
+  tmp += sizeof(uint32_t);
 
-  std::string pb_data_str(&tmp[pb_data_index], pb_data_len);
-  pb_struct->pb_data_ = pb_data_str;
+  data->err_code_ = GetInt32FromNetByte(tmp);
+  tmp += sizeof(int32_t);
+
+  data->err_info_len_ = GetInt32FromNetByte(tmp);
+  tmp += sizeof(int32_t);
 
-  // LOG_DEBUG << "decode succ,  pk_len = " << pk_len << ", service_name = " << pb_struct->service_full_name_;
+  int pb_data_len = pk_len - PB_V2_HEADER_LEN - data->err_info_len_ - sizeof(char);
+  if (data->err_info_len_ < 0 || pb_data_len < 0) {
+    LOG_ERROR << "parse error, err_info_len[" << data->err_info_len_ << "] of v2 package is invalid";
+    return false;
+  }
+
+  if (data->err_info_len_ != 0) {
+    data->err_info_.assign(tmp, data->err_info_len_);
+    tmp += data->err_info_len_;
+  }
+  data->pb_index_ = tmp - pk;
+  data->pb_data_len_ = pb_data_len;
 
-  pb_struct->decode_succ_ = true;
-  data = pb_struct;
+  // upper layer match reply and trace call by msg_seq_
+  data->msg_seq_ = std::to_string(data->msg_id_);
+  return true;
 }
 
 auto TinyPbCodeC::GenDataPtr() -> AbstractData::ptr { return std::make_shared<TinyPbStruct>(); }
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <memory>
+
 #include "tirpc/net/rpc/rpc_data.hpp"
 #include "tirpc/net/tcp/abstract_codec.hpp"
 #include "tirpc/net/tcp/abstract_data.hpp"
@@ -23,7 +25,45 @@ class TinyPbCodeC : public AbstractCodeC {
   // overwrite
   auto GenDataPtr() -> AbstractData::ptr override;
 
-  auto EncodePbData(TinyPbStruct *data, int &len) -> const char *;
+  // overwrite
+  auto Clone() -> AbstractCodeC::ptr override { return std::make_shared<TinyPbCodeC>(); }
+
+  /**
+   * @brief 把 v1 包直接编码到 buf 的可写区域，不产生中间拷贝
+   *
+   * @return 编码后的包长度，失败返回 0
+   */
+  auto EncodePbData(TinyPbStruct *data, TcpBuffer *buf) -> int;
+
+  auto EncodePbDataV2(TinyPbStruct *data, TcpBuffer *buf) -> int;
+
+ private:
+  /**
+   * @brief 写入业务数据，pb_msg_ 不为空时直接序列化到 dst
+   */
+  auto WritePbData(TinyPbStruct *data, char *dst, int pb_data_len) -> bool;
+
+  /**
+   * @brief 解析一个完整的 v1 包
+   *
+   * @param pk 包的起始位置
+   * @param pk_len 包长度
+   */
+  auto DecodePbDataV1(const char *pk, int32_t pk_len, TinyPbStruct *data) -> bool;
+
+  /**
+   * @brief 解析一个完整的 v2 包，所有字段都在固定偏移上
+   *
+   * @param pk 包的起始位置
+   * @param pk_len 包长度
+   */
+  auto DecodePbDataV2(const char *pk, int32_t pk_len, TinyPbStruct *data) -> bool;
+
+ private:
+  // pk_len of package which start at read index of buffer, -1 means header not parsed yet.
+  // partial package is waited without rescan, so every connection must own its codec
+  int32_t pending_pk_len_{-1};
+  int32_t max_pk_len_{0};  // tinypb.max_pk_len when codec is created
 };
 
 }  // namespace tirpc
@@ -1,11 +1,21 @@
 #pragma once
 
+#include <google/protobuf/message.h>
 #include <cstdint>
 #include <string>
 #include "tirpc/net/tcp/abstract_data.hpp"
+#include "tirpc/net/tcp/tcp_buffer.hpp"
 
 namespace tirpc {
 
+enum TinyPbVersion {
+  TinyPb_V1 = 1,  // variable length header, carry msg_req and service full name
+  TinyPb_V2 = 2,  // fixed size header, carry binary msg id and method id
+};
+
+// reserved method of TinyPb v1, client call it to negotiate v2 and get method ids of server
+const char TINYPB_NEGOTIATE_METHOD[] = "TinyPb.negotiate";
+
 class TinyPbStruct : public AbstractData {
  public:
   using pb_ptr = std::shared_ptr<TinyPbStruct>;
@@ -17,11 +27,36 @@ class TinyPbStruct : public AbstractData {
   auto operator=(TinyPbStruct &&) -> TinyPbStruct & = default;
   auto GetMsgReq() const -> std::string override { return msg_seq_; }
 
+  /**
+   * @brief 把业务数据解析到 msg，还在读缓冲区中的数据直接原地解析
+   */
+  auto ParsePbData(google::protobuf::Message *msg) const -> bool {
+    if (pb_buf_ == nullptr) {
+      return msg->ParseFromString(pb_data_);
+    }
+    TcpBufferInputStream stream(pb_buf_, pb_index_, pb_data_len_);
+    return msg->ParseFromZeroCopyStream(&stream);
+  }
+
+  /**
+   * @brief 把业务数据从读缓冲区拷贝到 pb_data_，在连接下一次读数据之后还要使用时调用
+   */
+  void DetachPbData() {
+    if (pb_buf_ != nullptr) {
+      pb_data_.assign(pb_buf_->buffer_.data() + pb_index_, pb_data_len_);
+      pb_buf_ = nullptr;
+    }
+  }
+
   /*
   **  min of package is: 1 + 4 + 4 + 4 + 4 + 4 + 4 + 1 = 26 bytes
   **
+  **  v2 package: start(1) + pk_len(4) + msg_id(8) + method_id(4) + err_code(4) + err_info_len(4)
+  **              + err_info + pb_data + end(1), its header is fixed 25 bytes
   */
 
+  int32_t version_{TinyPb_V1};  // wire format of this package
+
   // char start;                      // indentify start of a TinyPb protocal data
   int32_t pk_len_{0};              // len of all package(include start char and end char)
   int32_t msg_req_len_{0};         // len of msg_req
@@ -34,7 +69,15 @@ class TinyPbStruct : public AbstractData {
   std::string err_info_;   // err_info, empty -- call rpc success, otherwise -- call rpc failed, it will display details
                            // of reason why call rpc failed. it only be seted by RpcController
   std::string pb_data_;    // business pb data
+  // if not null, encode serialize it into out buffer directly instead of copying pb_data_
+  const google::protobuf::Message *pb_msg_{nullptr};
+  // decoded business data still in read buffer of connection, it's valid until next input of connection
+  TcpBuffer *pb_buf_{nullptr};
+  int32_t pb_index_{0};
+  int32_t pb_data_len_{0};
   int32_t check_num_{-1};  // check_num of all package. to check legality of data
+  uint64_t msg_id_{0};     // v2 only, binary msg id which is unique on a connection
+  uint32_t method_id_{0};  // v2 only, method id agreed when connection setup, 0 only in error replies
   // char end;                        // identify end of a TinyPb protocal data
 };
 
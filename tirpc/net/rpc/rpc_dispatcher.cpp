@@ -1,9 +1,13 @@
 #include "tirpc/net/rpc/rpc_dispatcher.hpp"
 
+#include <google/protobuf/arena.h>
 #include <google/protobuf/descriptor.h>
 #include <google/protobuf/message.h>
 #include <google/protobuf/service.h>
+#include <optional>
+#include <vector>
 
+#include "tirpc/common/config.hpp"
 #include "tirpc/common/error_code.hpp"
 #include "tirpc/common/msg_req.hpp"
 #include "tirpc/net/rpc/rpc_closure.hpp"
@@ -16,6 +20,74 @@ namespace tirpc {
 
 class TcpBuffer;
 
+static ConfigVar<int>::ptr g_arena_block_size = Config::Lookup(
+    "server.arena_block_size", 4096, "initial block size of protobuf arena of one request, 0 means not use arena");
+
+static const size_t MAX_CACHED_ARENA_BLOCK = 128;  // max free arena blocks kept by one io thread
+
+/**
+ * @brief 一次请求使用的 protobuf Arena，请求和回复消息都分配在上面，请求结束时一起释放
+ *
+ * Arena 的初始内存块由 IO 线程缓存复用，同一线程上协程交替处理的多个请求各自持有一块
+ */
+class RequestArena {
+ public:
+  RequestArena() {
+    int block_size = g_arena_block_size->GetValue();
+    if (block_size <= 0) {
+      return;
+    }
+    if (t_block_size_ != block_size) {
+      t_free_blocks_.clear();
+      t_block_size_ = block_size;
+    }
+    if (t_free_blocks_.empty()) {
+      block_ = std::make_unique<char[]>(block_size);
+    } else {
+      block_ = std::move(t_free_blocks_.back());
+      t_free_blocks_.pop_back();
+    }
+    google::protobuf::ArenaOptions options;
+    options.initial_block = block_.get();
+    options.initial_block_size = block_size;
+    options.start_block_size = block_size;
+    arena_.emplace(options);
+  }
+
+  ~RequestArena() {
+    // destroy messages on arena before reuse its block
+    arena_.reset();
+    if (block_ && t_free_blocks_.size() < MAX_CACHED_ARENA_BLOCK) {
+      t_free_blocks_.push_back(std::move(block_));
+    }
+  }
+
+  RequestArena(const RequestArena &) = delete;
+  auto operator=(const RequestArena &) -> RequestArena & = delete;
+
+  /**
+   * @brief 按 prototype 创建消息，消息由 RequestArena 持有
+   */
+  auto New(const google::protobuf::Message &prototype) -> google::protobuf::Message * {
+    if (arena_) {
+      return prototype.New(&(*arena_));
+    }
+    heap_msgs_.emplace_back(prototype.New());
+    return heap_msgs_.back().get();
+  }
+
+ private:
+  static thread_local std::vector<std::unique_ptr<char[]>> t_free_blocks_;
+  static thread_local int t_block_size_;
+
+  std::unique_ptr<char[]> block_;
+  std::optional<google::protobuf::Arena> arena_;
+  std::vector<std::unique_ptr<google::protobuf::Message>> heap_msgs_;  // only used when arena is disabled
+};
+
+thread_local std::vector<std::unique_ptr<char[]>> RequestArena::t_free_blocks_;
+thread_local int RequestArena::t_block_size_ = 0;
+
 void RpcDispatcher::Dispatch(AbstractData *data, TcpConnection *conn) {
   auto *tmp = dynamic_cast<TinyPbStruct *>(data);
   if (tmp == nullptr) {
@@ -29,60 +101,46 @@ void RpcDispatcher::Dispatch(AbstractData *data, TcpConnection *conn) {
 
   LOG_DEBUG << "begin to dispatch client tinypb request, msgno=" << tmp->msg_seq_;
 
-  std::string service_name;
-  std::string method_name;
+  if (tmp->version_ == TinyPb_V1 && tmp->service_full_name_ == TINYPB_NEGOTIATE_METHOD) {
+    ReplyNegotiate(tmp, conn);
+    return;
+  }
 
   TinyPbStruct reply_pk;
-  reply_pk.service_full_name_ = tmp->service_full_name_;
+  reply_pk.version_ = tmp->version_;
+  reply_pk.msg_id_ = tmp->msg_id_;
+  reply_pk.method_id_ = tmp->method_id_;
   reply_pk.msg_seq_ = tmp->msg_seq_;
   if (reply_pk.msg_seq_.empty()) {
     reply_pk.msg_seq_ = MsgReqUtil::GenMsgNumber();
   }
 
-  if (!ParseServiceFullName(tmp->service_full_name_, service_name, method_name)) {
-    std::stringstream ss;
-    ss << reply_pk.msg_seq_ << "|parse service name " << tmp->service_full_name_ << "error";
-    LOG_ERROR << ss.str();
-    reply_pk.err_code_ = ERROR_PARSE_SERVICE_NAME;
-    ss.str("");
-    ss << "cannot parse service_name:[" << tmp->service_full_name_ << "]";
-    reply_pk.err_info_ = ss.str();
-    conn->GetCodec()->Encode(conn->GetOutBuffer(), dynamic_cast<AbstractData *>(&reply_pk));
-    return;
+  const MethodEntry *entry = nullptr;
+  if (tmp->version_ == TinyPb_V2) {
+    if (tmp->method_id_ != 0 && tmp->method_id_ <= methods_.size()) {
+      entry = &methods_[tmp->method_id_ - 1];
+    }
+  } else {
+    reply_pk.service_full_name_ = tmp->service_full_name_;
+    auto it = method_index_.find(tmp->service_full_name_);
+    if (it != method_index_.end()) {
+      entry = &methods_[it->second - 1];
+    }
   }
-
-  runtime->interface_name_ = tmp->service_full_name_;
-  auto it = service_map_.find(service_name);
-  if (it == service_map_.end() || !((*it).second)) {
-    std::stringstream ss;
-    ss << reply_pk.msg_seq_ << "|not found service_name:[" << service_name << "]";
-    LOG_ERROR << ss.str();
-    reply_pk.err_code_ = ERROR_SERVICE_NOT_FOUND;
-    ss.str("");
-    ss << "not found service_name:[" << service_name << "]";
-    reply_pk.err_info_ = ss.str();
-    conn->GetCodec()->Encode(conn->GetOutBuffer(), dynamic_cast<AbstractData *>(&reply_pk));
+  if (entry == nullptr) {
+    ReplyNotFound(tmp, &reply_pk, conn);
     return;
   }
 
-  service_ptr service = (*it).second;
-  const google::protobuf::MethodDescriptor *method = service->GetDescriptor()->FindMethodByName(method_name);
-  if (method == nullptr) {
-    std::stringstream ss;
-    ss << reply_pk.msg_seq_ << "|not found method_name:[" << method_name << "]";
-    LOG_ERROR << ss.str();
-    reply_pk.err_code_ = ERROR_METHOD_NOT_FOUND;
-    ss.str("");
-    ss << "not found method_name:[" << method_name << "]";
-    reply_pk.err_info_ = ss.str();
-    conn->GetCodec()->Encode(conn->GetOutBuffer(), dynamic_cast<AbstractData *>(&reply_pk));
-    return;
-  }
+  runtime->interface_name_ = entry->full_name_;
+  const google::protobuf::MethodDescriptor *method = entry->method_;
+  service_ptr service = entry->service_;
 
-  std::unique_ptr<google::protobuf::Message> request(service->GetRequestPrototype(method).New());
+  RequestArena arena;
+  google::protobuf::Message *request = arena.New(*entry->request_prototype_);
   LOG_DEBUG << reply_pk.msg_seq_ << "|request.name = " << request->GetDescriptor()->full_name();
 
-  if (!request->ParseFromString(tmp->pb_data_)) {
+  if (!tmp->ParsePbData(request)) {
     std::stringstream ss;
     ss << reply_pk.msg_seq_ << "|faild to parse request data, request.name:[" << request->GetDescriptor()->full_name()
        << "]";
@@ -95,22 +153,24 @@ void RpcDispatcher::Dispatch(AbstractData *data, TcpConnection *conn) {
     return;
   }
 
-  std::unique_ptr<google::protobuf::Message> response(service->GetResponsePrototype(method).New());
+  google::protobuf::Message *response = arena.New(*entry->response_prototype_);
   LOG_DEBUG << reply_pk.msg_seq_ << "|response.name = " << response->GetDescriptor()->full_name();
 
   RpcController rpc_controller;
   rpc_controller.SetMsgSeq(reply_pk.msg_seq_);
-  rpc_controller.SetMethodName(method_name);
-  rpc_controller.SetMethodFullName(tmp->service_full_name_);
+  rpc_controller.SetMethodName(method->name());
+  rpc_controller.SetMethodFullName(entry->full_name_);
 
   std::function<void()> reply_package_func = []() {};
   RpcClosure closure(reply_package_func);
-  service->CallMethod(method, &rpc_controller, request.get(), response.get(), &closure);
+  service->CallMethod(method, &rpc_controller, request, response, &closure);
 
   LOG_INFO << "Called successfully, now send reply package";
 
-  if (!(response->SerializeToString(&(reply_pk.pb_data_)))) {
-    reply_pk.pb_data_ = "";
+  if (response->IsInitialized()) {
+    // serialize response into out buffer directly when encode
+    reply_pk.pb_msg_ = response;
+  } else {
     std::stringstream ss;
     ss << reply_pk.msg_seq_ << "|reply error! encode reply package error";
     LOG_ERROR << ss.str();
@@ -144,8 +204,63 @@ auto RpcDispatcher::ParseServiceFullName(const std::string &full_name, std::stri
   return true;
 }
 
+void RpcDispatcher::ReplyNotFound(TinyPbStruct *req, TinyPbStruct *reply_pk, TcpConnection *conn) {
+  // it's not hot path, find out why the method is not found
+  std::stringstream ss;
+  std::string service_name;
+  std::string method_name;
+  if (req->version_ == TinyPb_V2) {
+    reply_pk->err_code_ = ERROR_METHOD_NOT_FOUND;
+    ss << "not found method_id:[" << req->method_id_ << "]";
+  } else if (!ParseServiceFullName(req->service_full_name_, service_name, method_name)) {
+    reply_pk->err_code_ = ERROR_PARSE_SERVICE_NAME;
+    ss << "cannot parse service_name:[" << req->service_full_name_ << "]";
+  } else if (service_map_.find(service_name) == service_map_.end()) {
+    reply_pk->err_code_ = ERROR_SERVICE_NOT_FOUND;
+    ss << "not found service_name:[" << service_name << "]";
+  } else {
+    reply_pk->err_code_ = ERROR_METHOD_NOT_FOUND;
+    ss << "not found method_name:[" << method_name << "]";
+  }
+  reply_pk->err_info_ = ss.str();
+  LOG_ERROR << reply_pk->msg_seq_ << "|" << reply_pk->err_info_;
+  conn->GetCodec()->Encode(conn->GetOutBuffer(), dynamic_cast<AbstractData *>(reply_pk));
+}
+
+void RpcDispatcher::ReplyNegotiate(TinyPbStruct *req, TcpConnection *conn) {
+  TinyPbStruct reply_pk;
+  reply_pk.service_full_name_ = req->service_full_name_;
+  reply_pk.msg_seq_ = req->msg_seq_;
+  for (std::size_t i = 0; i < methods_.size(); ++i) {
+    if (i != 0) {
+      reply_pk.pb_data_.push_back('\n');
+    }
+    reply_pk.pb_data_.append(methods_[i].full_name_);
+  }
+  LOG_DEBUG << reply_pk.msg_seq_ << "|reply tinypb negotiate, method count = " << methods_.size();
+  conn->GetCodec()->Encode(conn->GetOutBuffer(), dynamic_cast<AbstractData *>(&reply_pk));
+}
+
 void RpcDispatcher::RegisterService(service_ptr service) {
-  std::string service_name = service->GetDescriptor()->full_name();
+  const google::protobuf::ServiceDescriptor *desc = service->GetDescriptor();
+  std::string service_name = desc->full_name();
+  for (int i = 0; i < desc->method_count(); ++i) {
+    MethodEntry entry;
+    entry.service_ = service;
+    entry.method_ = desc->method(i);
+    entry.request_prototype_ = &service->GetRequestPrototype(entry.method_);
+    entry.response_prototype_ = &service->GetResponsePrototype(entry.method_);
+    entry.full_name_ = service_name + "." + entry.method_->name();
+
+    auto it = method_index_.find(entry.full_name_);
+    if (it != method_index_.end()) {
+      // register again, keep its method id
+      methods_[it->second - 1] = std::move(entry);
+      continue;
+    }
+    methods_.push_back(std::move(entry));
+    method_index_[methods_.back().full_name_] = methods_.size();
+  }
   service_map_[service_name] = service;
   LOG_INFO << "Successfully register service [" << service_name << "]!";
 }
@@ -5,7 +5,11 @@
 #include <google/protobuf/service.h>
 #include <map>
 #include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
 
+#include "tirpc/net/rpc/rpc_data.hpp"
 #include "tirpc/net/tcp/abstract_dispatcher.hpp"
 
 namespace tirpc {
@@ -48,10 +52,41 @@ class RpcDispatcher : public AbstractDispatcher {
    */
   void RegisterService(service_ptr service);
 
+ private:
+  /**
+   * @brief 注册时为每个方法预先算好的分发信息，Dispatch 只需要查一次表
+   *
+   */
+  struct MethodEntry {
+    service_ptr service_;
+    const google::protobuf::MethodDescriptor *method_{nullptr};
+    const google::protobuf::Message *request_prototype_{nullptr};
+    const google::protobuf::Message *response_prototype_{nullptr};
+    std::string full_name_;  // "service_name.method_name"
+  };
+
+  /**
+   * @brief 找不到请求的方法时回复错误，区分是服务名解析失败、服务不存在还是方法不存在
+   *
+   */
+  void ReplyNotFound(TinyPbStruct *req, TinyPbStruct *reply_pk, TcpConnection *conn);
+
+  /**
+   * @brief 回复 TinyPb v2 握手请求，按 method_id 顺序返回所有方法全名，以 '\n' 分隔
+   *
+   */
+  void ReplyNegotiate(TinyPbStruct *req, TcpConnection *conn);
+
  public:
   // all services should be registerd on there before progress start
   // key: service_name
   std::map<std::string, service_ptr> service_map_;
+
+ private:
+  // method_id of TinyPb v2 is index + 1 of this vector, it must not change after server start
+  std::vector<MethodEntry> methods_;
+  // key: "service_name.method_name", value: method_id
+  std::unordered_map<std::string, uint32_t> method_index_;
 };
 
 }  // namespace tirpc
@@ -23,6 +23,9 @@ class AbstractCodeC {
   virtual void Decode(TcpBuffer *buf, AbstractData *data) = 0;
 
   virtual auto GenDataPtr() -> AbstractData::ptr = 0;
+
+  // codec may keep decode state of one connection, every connection get its own codec by clone
+  virtual auto Clone() -> AbstractCodeC::ptr = 0;
 };
 
 }  // namespace tirpc
\ No newline at end of file
@@ -6,8 +6,10 @@
 #include <map>
 #include <memory>
 #include <utility>
+#include <vector>
 
 #include "tirpc/common/config.hpp"
+#include "tirpc/common/util.hpp"
 #include "tirpc/coroutine/coroutine.hpp"
 #include "tirpc/coroutine/coroutine_pool.hpp"
 #include "tirpc/net/base/reactor.hpp"
@@ -17,11 +19,15 @@
 
 namespace tirpc {
 
+static ConfigVar<std::vector<int>>::ptr g_io_thread_cpus =
+    Config::Lookup("cpu_affinity.io_threads", std::vector<int>{},
+                   "cpus io threads bound to, io thread i uses the (i % size)th one. empty means not bound");
+
 static thread_local Reactor *t_reactor_ptr = nullptr;
 
 static thread_local IOThread *t_cur_io_thread = nullptr;
 
-IOThread::IOThread() {
+IOThread::IOThread(int index) : index_(index) {
   int rt = sem_init(&init_semaphore_, 0, 0);
   assert(rt == 0);
 
@@ -67,16 +73,27 @@ auto IOThread::GetThreadIndex() -> int { return index_; }
 auto IOThread::Main(void *arg) -> void * {
   // assert(t_reactor_ptr == nullptr);
 
+  auto *thread = static_cast<IOThread *>(arg);
+  std::vector<int> cpus = g_io_thread_cpus->GetValue();
+  if (!cpus.empty()) {
+    // bind before anything is allocated, so reactor, stacks and buffers first touched here are on local node
+    int cpu = cpus[static_cast<size_t>(thread->index_) % cpus.size()];
+    if (ThreadUtil::BindCpu(cpu)) {
+      LOG_INFO << "io thread [" << thread->index_ << "] is bound to cpu [" << cpu << "]";
+    }
+  }
+
   t_reactor_ptr = new Reactor();
   assert(t_reactor_ptr != nullptr);
 
-  auto *thread = static_cast<IOThread *>(arg);
   t_cur_io_thread = thread;
   thread->reactor_ = t_reactor_ptr;
   thread->reactor_->SetReactorType(SubReactor);
   thread->tid_ = GetTid();
 
   Coroutine::GetCurrentCoroutine();
+  // coroutine pool owned by this thread, its stacks are allocated after binding cpu
+  GetCoroutinePool();
 
   LOG_DEBUG << "finish iothread init, now post semaphore";
   sem_post(&thread->init_semaphore_);
@@ -95,7 +112,7 @@ auto IOThread::Main(void *arg) -> void * {
 IOThreadPool::IOThreadPool(int size) : size_(size) {
   io_threads_.resize(size);
   for (int i = 0; i < size; ++i) {
-    io_threads_[i] = std::make_shared<IOThread>();
+    io_threads_[i] = std::make_shared<IOThread>(i);
     io_threads_[i]->SetThreadIndex(i);
   }
 }
@@ -114,6 +131,8 @@ auto IOThreadPool::GetIoThread() -> IOThread * {
   return io_threads_[index_++].get();
 }
 
+auto IOThreadPool::GetIoThreadByIndex(int index) -> IOThread * { return io_threads_[index].get(); }
+
 auto IOThreadPool::GetIoThreadPoolSize() -> int { return size_; }
 
 void IOThreadPool::BroadcastTask(std::function<void()> cb) {
@@ -17,7 +17,7 @@ class TcpServer;
 class IOThread {
  public:
   using ptr = std::shared_ptr<IOThread>;
-  IOThread();
+  explicit IOThread(int index);
 
   ~IOThread();
 
@@ -59,6 +59,8 @@ class IOThreadPool {
 
   auto GetIoThread() -> IOThread *;
 
+  auto GetIoThreadByIndex(int index) -> IOThread *;
+
   auto GetIoThreadPoolSize() -> int;
 
   void BroadcastTask(std::function<void()> cb);
@@ -41,12 +41,16 @@ void TcpBuffer::ResizeBuffer(int size) {
 }
 
 void TcpBuffer::WriteToBuffer(const char *buf, int size) {
+  memcpy(ReserveWrite(size), buf, size);
+  write_index_ += size;
+}
+
+auto TcpBuffer::ReserveWrite(int size) -> char * {
   if (size > Writeable()) {
     int new_size = static_cast<int>(1.5 * (write_index_ + size));
     ResizeBuffer(new_size);
   }
-  memcpy(&buffer_[write_index_], buf, size);
-  write_index_ += size;
+  return buffer_.data() + write_index_;
 }
 
 void TcpBuffer::ReadFromBuffer(std::vector<char> &re, int size) {
@@ -87,14 +91,16 @@ void TcpBuffer::ClearBuffer() {
   write_index_ = 0;
 }
 
-void TcpBuffer::RecycleRead(int index) {
+void TcpBuffer::RecycleRead(int index, bool adjust /*= true*/) {
   int j = read_index_ + index;
   if (j > static_cast<int>(buffer_.size())) {
     LOG_ERROR << "recycleRead error";
     return;
   }
   read_index_ = j;
-  AdjustBuffer();
+  if (adjust) {
+    AdjustBuffer();
+  }
 }
 
 void TcpBuffer::RecycleWrite(int index) {
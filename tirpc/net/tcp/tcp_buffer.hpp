@@ -1,5 +1,6 @@
 #pragma once
 
+#include <google/protobuf/io/zero_copy_stream_impl_lite.h>
 #include <memory>
 #include <string>
 #include <vector>
@@ -23,6 +24,9 @@ class TcpBuffer {
 
   void WriteToBuffer(const char *buf, int size);
 
+  // make sure size bytes are writeable and return where to write, call RecycleWrite after writing
+  auto ReserveWrite(int size) -> char *;
+
   void ReadFromBuffer(std::vector<char> &re, int size);
 
   void ResizeBuffer(int size);
@@ -35,7 +39,8 @@ class TcpBuffer {
 
   auto GetBufferString() -> std::string;
 
-  void RecycleRead(int index);
+  // adjust is false means consumed data won't be moved, TcpBufferInputStream on it keeps valid until AdjustBuffer
+  void RecycleRead(int index, bool adjust = true);
 
   void RecycleWrite(int index);
 
@@ -50,4 +55,13 @@ class TcpBuffer {
   std::vector<char> buffer_;
 };
 
+/**
+ * @brief TcpBuffer 中一段数据的只读视图，protobuf 可以直接从读缓冲区解析，不需要先拷贝出来
+ *
+ */
+class TcpBufferInputStream : public google::protobuf::io::ArrayInputStream {
+ public:
+  TcpBufferInputStream(TcpBuffer *buf, int index, int size) : ArrayInputStream(buf->buffer_.data() + index, size) {}
+};
+
 }  // namespace tirpc
\ No newline at end of file
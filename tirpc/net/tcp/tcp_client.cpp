@@ -1,12 +1,17 @@
 #include "tirpc/net/tcp/tcp_client.hpp"
 
 #include <arpa/inet.h>
+#include <poll.h>
 #include <sys/socket.h>
 
+#include <map>
+#include <memory>
 #include <utility>
 
+#include "tirpc/common/config.hpp"
 #include "tirpc/common/error_code.hpp"
 #include "tirpc/common/log.hpp"
+#include "tirpc/common/msg_req.hpp"
 #include "tirpc/coroutine/coroutine.hpp"
 #include "tirpc/coroutine/coroutine_hook.hpp"
 #include "tirpc/coroutine/coroutine_pool.hpp"
@@ -18,6 +23,9 @@
 
 namespace tirpc {
 
+static ConfigVar<bool>::ptr g_client_tinypb_v2 =
+    Config::Lookup("client.tinypb_v2", true, "whether pooled connections negotiate TinyPb v2 header");
+
 TcpClient::TcpClient(Address::ptr addr, ProtocalType type /*= TinyPb_Protocal*/) : peer_addr_(std::move(addr)) {
   family_ = peer_addr_->GetFamily();
   fd_ = socket(AF_INET, SOCK_STREAM, 0);
@@ -38,7 +46,8 @@ TcpClient::TcpClient(Address::ptr addr, ProtocalType type /*= TinyPb_Protocal*/)
 }
 
 TcpClient::~TcpClient() {
-  if (fd_ > 0) {
+  // closed connection has already closed fd, don't close it twice
+  if (fd_ > 0 && connection_->GetState() != Closed) {
     FdEventContainer::GetFdContainer()->GetFdEvent(fd_)->UnregisterFromReactor();
     close(fd_);
     LOG_DEBUG << "~TcpClient() close fd = " << fd_;
@@ -63,104 +72,279 @@ void TcpClient::ResetFd() {
   }
 }
 
-auto TcpClient::SendAndRecvTinyPb(const std::string &msg_no, TinyPbStruct::pb_ptr &res) -> int {
-  bool is_timeout = false;
-  Coroutine *cur_cor = Coroutine::GetCurrentCoroutine();
-  auto timer_cb = [this, &is_timeout, cur_cor]() {
+auto TcpClient::IsBroken() -> bool { return fd_ == -1 || connection_->GetState() == Closed; }
+
+auto TcpClient::SendAndRecvTinyPb(const std::string &msg_no, TinyPbStruct::pb_ptr &res,
+                                  google::protobuf::Message *response /*= nullptr*/) -> int {
+  // other coroutines and timer write it while this one yields, keep it off the stack which may be shared
+  auto call_holder = std::make_unique<PendingCall>();
+  PendingCall &call = *call_holder;
+  call.cor_ = Coroutine::GetCurrentCoroutine();
+  call.response_ = response;
+  auto timer_cb = [this, &call]() {
     LOG_INFO << "TcpClient timer out event occur";
-    is_timeout = true;
-    this->connection_->SetOverTimeFlag(true);
-    Coroutine::Resume(cur_cor);
+    call.is_timeout_ = true;
+    if (call.state_ == CallWoken) {
+      // resume has been posted, reply or io ownership is ready
+      return;
+    }
+    if (call.state_ == CallRunning) {
+      // this call is blocked in io hook, let it break out
+      this->connection_->SetOverTimeFlag(true);
+    }
+    call.state_ = CallRunning;
+    Coroutine::Resume(call.cor_);
   };
-  TimerEvent::ptr event = std::make_shared<TimerEvent>(max_timeout_, false, timer_cb);
+  int timeout = max_timeout_;
+  TimerEvent::ptr event = std::make_shared<TimerEvent>(timeout, false, timer_cb);
   reactor_->GetTimer()->AddTimerEvent(event);
 
   LOG_DEBUG << "add rpc timer event, timeout on " << event->arrive_time_;
 
-  while (!is_timeout) {
-    LOG_DEBUG << "begin to connect";
-    if (connection_->GetState() != Connected) {
-      int rt = connect_hook(fd_, reinterpret_cast<sockaddr *>(peer_addr_->GetSockAddr()), peer_addr_->GetSockLen());
-      if (rt == 0) {
-        LOG_DEBUG << "connect [" << peer_addr_->ToString() << "] succ!";
-        connection_->SetUpClient();
-        break;
-      }
-      ResetFd();
-      if (errno == ECONNREFUSED) {
-        std::stringstream ss;
-        ss << "connect error, peer[ " << peer_addr_->ToString() << " ] closed.";
-        err_info_ = ss.str();
-        LOG_ERROR << "cancle overtime event, err info=" << err_info_;
-        reactor_->GetTimer()->DelTimerEvent(event);
-        return ERROR_PEER_CLOSED;
-      }
-      if (errno == EAFNOSUPPORT) {
-        std::stringstream ss;
-        ss << "connect cur sys ror, errinfo is " << std::string(strerror(errno)) << " ] closed.";
-        err_info_ = ss.str();
-        LOG_ERROR << "cancle overtime event, err info=" << err_info_;
-        reactor_->GetTimer()->DelTimerEvent(event);
-        return ERROR_CONNECT_SYS_ERR;
+  pending_calls_[msg_no] = &call;
+
+  int rt = 0;
+  while (true) {
+    if (call.res_) {
+      rt = 0;
+      break;
+    }
+    if (call.is_timeout_) {
+      rt = ERROR_RPC_CALL_TIMEOUT;
+      break;
+    }
+    if (IsBroken()) {
+      rt = ERROR_PEER_CLOSED;
+      break;
+    }
+    if (io_busy_ && !Coroutine::IsMainCoroutine()) {
+      // other coroutine owns the socket, it sends the request we appended and delivers reply to us
+      if (io_waiting_) {
+        // owner only waits for readable, wake it up to send our request
+        FdEventContainer::GetFdContainer()->GetFdEvent(fd_)->AddListenEvents(IOEvent::WRITE);
       }
-    } else {
+      call.state_ = CallParked;
+      Coroutine::Yield();
+      call.state_ = CallRunning;
+      continue;
+    }
+    io_busy_ = true;
+    rt = DriveIo(&call);
+    io_busy_ = false;
+    if (rt != 0) {
       break;
     }
   }
 
-  if (connection_->GetState() != Connected) {
-    std::stringstream ss;
-    ss << "connect peer addr[" << peer_addr_->ToString() << "] error. sys error=" << strerror(errno);
+  pending_calls_.erase(msg_no);
+  reactor_->GetTimer()->DelTimerEvent(event);
+
+  if (IsBroken()) {
+    // every waiting call should know the connection is gone
+    WakeupAll();
+  } else if (!io_busy_) {
+    // hand over io ownership to one waiting call
+    for (auto &i : pending_calls_) {
+      if (i.second->state_ == CallParked) {
+        WakeupCall(i.second);
+        break;
+      }
+    }
+  }
+
+  if (rt == 0) {
+    res = call.res_;
+    if (response != nullptr && !call.is_parsed_) {
+      call.parse_succ_ = call.res_->ParsePbData(response);
+    }
+    if (response != nullptr && !call.parse_succ_) {
+      err_info_ = "failed to deserialize data from server";
+      return ERROR_FAILED_DESERIALIZE;
+    }
+    err_info_ = "";
+    return 0;
+  }
+
+  std::stringstream ss;
+  if (rt == ERROR_RPC_CALL_TIMEOUT) {
+    ss << "call rpc falied, over " << timeout << " ms";
+    err_info_ = ss.str();
+  } else if (rt == ERROR_PEER_CLOSED && err_info_.empty()) {
+    ss << "call rpc falied, peer closed [" << peer_addr_->ToString() << "]";
     err_info_ = ss.str();
-    reactor_->GetTimer()->DelTimerEvent(event);
-    return ERROR_FAILED_CONNECT;
   }
+  return rt;
+}
 
-  connection_->SetUpClient();
-  connection_->Output();
-  if (connection_->GetOverTimerFlag()) {
-    LOG_INFO << "send data over time";
-    is_timeout = true;
-    goto err_deal;
+auto TcpClient::Connect() -> int {
+  LOG_DEBUG << "begin to connect";
+  int rt = connect_hook(fd_, reinterpret_cast<sockaddr *>(peer_addr_->GetSockAddr()), peer_addr_->GetSockLen());
+  if (rt == 0) {
+    LOG_DEBUG << "connect [" << peer_addr_->ToString() << "] succ!";
+    connection_->SetUpClient();
+    return 0;
   }
 
-  while (!connection_->GetResPackageData(msg_no, res)) {
-    LOG_DEBUG << "redo getResPackageData";
-    connection_->Input();
+  std::stringstream ss;
+  int err = ERROR_FAILED_CONNECT;
+  if (errno == ECONNREFUSED) {
+    ss << "connect error, peer[ " << peer_addr_->ToString() << " ] closed.";
+    err = ERROR_PEER_CLOSED;
+  } else if (errno == EAFNOSUPPORT) {
+    ss << "connect cur sys ror, errinfo is " << std::string(strerror(errno)) << " ] closed.";
+    err = ERROR_CONNECT_SYS_ERR;
+  } else {
+    ss << "connect peer addr[" << peer_addr_->ToString() << "] error. sys error=" << strerror(errno);
+  }
+  err_info_ = ss.str();
+  LOG_ERROR << "cancle overtime event, err info=" << err_info_;
+
+  // this client can't be used any more, TcpClientPool will drop it
+  FdEventContainer::GetFdContainer()->GetFdEvent(fd_)->UnregisterFromReactor();
+  close(fd_);
+  fd_ = -1;
+  return err;
+}
+
+auto TcpClient::DriveIo(PendingCall *call) -> int {
+  if (connection_->GetState() != Connected) {
+    int rt = Connect();
+    if (rt != 0) {
+      return rt;
+    }
+  }
 
+  connection_->Output();
+  while (!call->res_) {
     if (connection_->GetOverTimerFlag()) {
-      LOG_INFO << "read data over time";
-      is_timeout = true;
-      goto err_deal;
+      LOG_INFO << "send or read data over time";
+      connection_->SetOverTimeFlag(false);
+      return 0;
     }
     if (connection_->GetState() == Closed) {
       LOG_INFO << "peer close";
-      goto err_deal;
+      return 0;
+    }
+
+    if (!Coroutine::IsMainCoroutine()) {
+      // wait here rather than in Input, so that request appended by parked calls can wake it up
+      int events = IOEvent::READ | (connection_->GetOutBuffer()->Readable() > 0 ? IOEvent::WRITE : 0);
+      io_waiting_ = true;
+      int revents = wait_events_hook(fd_, events);
+      io_waiting_ = false;
+      if ((revents & (POLLIN | POLLERR | POLLHUP)) == 0) {
+        // woken by timer, or socket is writable for requests of parked calls
+        connection_->Output();
+        continue;
+      }
+    }
+
+    LOG_DEBUG << "redo getResPackageData";
+    connection_->Input();
+    if (connection_->GetOverTimerFlag() || connection_->GetState() == Closed) {
+      continue;
     }
 
     connection_->Execute();
-  }
+    DeliverReplies(call);
 
-  reactor_->GetTimer()->DelTimerEvent(event);
-  err_info_ = "";
+    // flush requests of parked calls appended during Input
+    connection_->Output();
+  }
   return 0;
+}
 
-err_deal:
-  // connect error should close fd and reopen new one
-  FdEventContainer::GetFdContainer()->GetFdEvent(fd_)->UnregisterFromReactor();
-  close(fd_);
-  fd_ = socket(AF_INET, SOCK_STREAM, 0);
-  std::stringstream ss;
-  if (is_timeout) {
-    ss << "call rpc falied, over " << max_timeout_ << " ms";
-    err_info_ = ss.str();
+void TcpClient::NegotiateTinyPb() {
+  TinyPbStruct req;
+  req.service_full_name_ = TINYPB_NEGOTIATE_METHOD;
+  req.msg_seq_ = MsgReqUtil::GenMsgNumber();
+  connection_->GetCodec()->Encode(connection_->GetOutBuffer(), &req);
+  if (req.encode_succ_) {
+    negotiate_msg_no_ = req.msg_seq_;
+  }
+}
 
-    connection_->SetOverTimeFlag(false);
-    return ERROR_RPC_CALL_TIMEOUT;
+auto TcpClient::PrepareTinyPb(TinyPbStruct &req) -> std::string {
+  auto it = method_ids_.find(req.service_full_name_);
+  if (it != method_ids_.end()) {
+    req.version_ = TinyPb_V2;
+    req.method_id_ = it->second;
+    req.msg_id_ = ++next_msg_id_;
+    return std::to_string(req.msg_id_);
+  }
+
+  req.version_ = TinyPb_V1;
+  if (HasPendingCall(req.msg_seq_)) {
+    // replies on a shared connection are matched by msg_seq, it must be unique
+    req.msg_seq_ = MsgReqUtil::GenMsgNumber();
+    LOG_DEBUG << "msgno already in flight on this connection, generate new msgno = " << req.msg_seq_;
+  }
+  return req.msg_seq_;
+}
+
+void TcpClient::DeliverReplies(PendingCall *owner) {
+  std::map<std::string, TinyPbStruct::pb_ptr> replies;
+  connection_->TakeResPackageData(replies);
+  for (auto &i : replies) {
+    if (!negotiate_msg_no_.empty() && i.first == negotiate_msg_no_) {
+      negotiate_msg_no_.clear();
+      i.second->DetachPbData();
+      if (i.second->err_code_ != 0) {
+        // old server doesn't know TinyPb v2, keep using v1
+        LOG_INFO << "peer [" << peer_addr_->ToString() << "] doesn't support TinyPb v2, err_info=" << i.second->err_info_;
+        continue;
+      }
+      const std::string &names = i.second->pb_data_;
+      uint32_t method_id = 1;
+      for (std::size_t begin = 0; begin < names.length(); ++method_id) {
+        std::size_t end = names.find('\n', begin);
+        if (end == std::string::npos) {
+          end = names.length();
+        }
+        method_ids_[names.substr(begin, end - begin)] = method_id;
+        begin = end + 1;
+      }
+      LOG_DEBUG << "negotiate TinyPb v2 with [" << peer_addr_->ToString() << "] succ, method count = "
+                << method_ids_.size();
+      continue;
+    }
+    auto it = pending_calls_.find(i.first);
+    if (it == pending_calls_.end()) {
+      // caller of this reply has already timeout, drop it
+      LOG_DEBUG << i.first << "|drop reply data, no pending call";
+      continue;
+    }
+    // reply data refers to read buffer, parse it in place while it's valid
+    // response of a yielded coroutine on shared stack isn't in memory now, it parses detached data after it's woken
+    if (it->second->response_ != nullptr && (it->second == owner || !it->second->cor_->IsSharedStack())) {
+      it->second->parse_succ_ = i.second->ParsePbData(it->second->response_);
+      it->second->is_parsed_ = true;
+      // pb data has been used up, drop reference to read buffer without copying it
+      i.second->pb_buf_ = nullptr;
+    } else {
+      // caller parses it after next input moves read buffer, and short connection frees it with the client
+      i.second->DetachPbData();
+    }
+    it->second->res_ = i.second;
+    if (it->second != owner) {
+      WakeupCall(it->second);
+    }
+  }
+}
+
+void TcpClient::WakeupCall(PendingCall *call) {
+  if (call->state_ != CallParked) {
+    return;
+  }
+  call->state_ = CallWoken;
+  Coroutine *cor = call->cor_;
+  reactor_->AddTask([cor]() { Coroutine::Resume(cor); }, false);
+}
+
+void TcpClient::WakeupAll() {
+  for (auto &i : pending_calls_) {
+    WakeupCall(i.second);
   }
-  ss << "call rpc falied, peer closed [" << peer_addr_->ToString() << "]";
-  err_info_ = ss.str();
-  return ERROR_PEER_CLOSED;
 }
 
 void TcpClient::Stop() {
@@ -170,4 +354,38 @@ void TcpClient::Stop() {
   }
 }
 
+static thread_local TcpClientPool *t_tcp_client_pool = nullptr;
+
+auto TcpClientPool::GetTcpClientPool() -> TcpClientPool * {
+  if (t_tcp_client_pool == nullptr) {
+    t_tcp_client_pool = new TcpClientPool();
+  }
+  return t_tcp_client_pool;
+}
+
+auto TcpClientPool::GetClient(const Address::ptr &addr) -> TcpClient::ptr {
+  std::string key = addr->ToString();
+  auto it = clients_.find(key);
+  if (it != clients_.end()) {
+    if (!it->second->IsBroken()) {
+      return it->second;
+    }
+    LOG_DEBUG << "pooled connection to [" << key << "] is broken, create new one";
+    clients_.erase(it);
+  }
+  TcpClient::ptr client = std::make_shared<TcpClient>(addr);
+  if (g_client_tinypb_v2->GetValue()) {
+    client->NegotiateTinyPb();
+  }
+  clients_.emplace(key, client);
+  return client;
+}
+
+void TcpClientPool::RemoveClient(const Address::ptr &addr, const TcpClient::ptr &client) {
+  auto it = clients_.find(addr->ToString());
+  if (it != clients_.end() && it->second == client) {
+    clients_.erase(it);
+  }
+}
+
 }  // namespace tirpc
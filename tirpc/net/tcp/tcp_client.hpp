@@ -1,7 +1,10 @@
 #pragma once
 
+#include <google/protobuf/message.h>
 #include <google/protobuf/service.h>
 #include <memory>
+#include <string>
+#include <unordered_map>
 
 #include "tirpc/coroutine/coroutine.hpp"
 #include "tirpc/coroutine/coroutine_hook.hpp"
@@ -15,6 +18,10 @@ namespace tirpc {
 //
 // You should use TcpClient in a coroutine(not main coroutine)
 //
+// One TcpClient can be shared by many coroutines of the same thread, every call is matched to its reply by msg_seq.
+// Only one coroutine drives the socket at a time, the others park until their reply is delivered.
+// A parked coroutine adds write event to the owner's wait, so its request is sent without waiting for other replies.
+//
 class TcpClient {
  public:
   using ptr = std::shared_ptr<TcpClient>;
@@ -27,7 +34,13 @@ class TcpClient {
 
   void ResetFd();
 
-  auto SendAndRecvTinyPb(const std::string &msg_no, TinyPbStruct::pb_ptr &res) -> int;
+  /**
+   * @brief 发送请求并等待回包
+   *
+   * @param response 不为空时回包的业务数据直接从读缓冲区解析到 response 中
+   */
+  auto SendAndRecvTinyPb(const std::string &msg_no, TinyPbStruct::pb_ptr &res,
+                         google::protobuf::Message *response = nullptr) -> int;
 
   void Stop();
 
@@ -45,6 +58,55 @@ class TcpClient {
 
   auto GetCodeC() -> AbstractCodeC::ptr { return codec_; }
 
+  /**
+   * @brief 连接已关闭或出错，不能再复用
+   */
+  auto IsBroken() -> bool;
+
+  /**
+   * @brief 是否有 msg_no 对应的请求还在等待回包
+   */
+  auto HasPendingCall(const std::string &msg_no) const -> bool { return pending_calls_.count(msg_no) != 0; }
+
+  /**
+   * @brief 把 TinyPb v2 握手请求写入发送缓冲区，随第一个请求一起发出，不会多一次往返
+   */
+  void NegotiateTinyPb();
+
+  /**
+   * @brief 在编码前填充请求的协议版本和消息 id，握手成功后使用 v2 包头
+   *
+   * @return 用于匹配回包的 msg_no
+   */
+  auto PrepareTinyPb(TinyPbStruct &req) -> std::string;
+
+ private:
+  enum CallState {
+    CallRunning = 1,  // call is running or blocked in io hook
+    CallParked = 2,   // call yield and wait for reply or io ownership
+    CallWoken = 3,    // resume of this call has been posted to reactor
+  };
+
+  struct PendingCall {
+    Coroutine *cor_{nullptr};
+    CallState state_{CallRunning};
+    bool is_timeout_{false};
+    TinyPbStruct::pb_ptr res_;
+    google::protobuf::Message *response_{nullptr};  // parse reply into it when reply delivered
+    bool is_parsed_{false};                         // false if caller should parse res_ itself
+    bool parse_succ_{false};
+  };
+
+  auto Connect() -> int;
+
+  auto DriveIo(PendingCall *call) -> int;
+
+  void DeliverReplies(PendingCall *owner);
+
+  void WakeupCall(PendingCall *call);
+
+  void WakeupAll();
+
  private:
   int family_{0};
   int fd_{-1};
@@ -61,6 +123,38 @@ class TcpClient {
   AbstractCodeC::ptr codec_{nullptr};
 
   bool connect_succ_{false};
+
+  bool io_busy_{false};     // true when one coroutine owns the socket io
+  bool io_waiting_{false};  // io owner waits for reply, request appended by others should wake it up
+
+  std::unordered_map<std::string, PendingCall *> pending_calls_;
+
+  std::string negotiate_msg_no_;                         // msg_no of TinyPb v2 negotiate request in flight
+  std::unordered_map<std::string, uint32_t> method_ids_;  // empty means peer only speaks TinyPb v1
+  uint64_t next_msg_id_{0};
+};
+
+/**
+ * @brief 每个线程一个的 TcpClient 连接池，按对端地址复用连接
+ *
+ */
+class TcpClientPool {
+ public:
+  /**
+   * @brief 获取连到 addr 的连接，已断开的连接会被丢弃并重新创建
+   */
+  auto GetClient(const Address::ptr &addr) -> TcpClient::ptr;
+
+  /**
+   * @brief 把出错的连接移出连接池，正在使用它的调用不受影响
+   */
+  void RemoveClient(const Address::ptr &addr, const TcpClient::ptr &client);
+
+ public:
+  static auto GetTcpClientPool() -> TcpClientPool *;
+
+ private:
+  std::unordered_map<std::string, TcpClient::ptr> clients_;
 };
 
 }  // namespace tirpc
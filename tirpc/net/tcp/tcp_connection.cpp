@@ -13,7 +13,6 @@
 #include "tirpc/net/rpc/rpc_codec.hpp"
 #include "tirpc/net/rpc/rpc_data.hpp"
 #include "tirpc/net/tcp/abstract_data.hpp"
-#include "tirpc/net/tcp/abstract_slot.hpp"
 #include "tirpc/net/tcp/tcp_client.hpp"
 #include "tirpc/net/tcp/tcp_connection_time_wheel.hpp"
 #include "tirpc/net/tcp/tcp_server.hpp"
@@ -27,11 +26,10 @@ TcpConnection::TcpConnection(TcpServer *tcp_svr, IOThread *io_thread, int fd, in
   // LOG_DEBUG << "state_=[" << state_ << "], =" << fd;
   server_ = tcp_svr;
 
-  codec_ = server_->GetCodec();
+  codec_ = server_->GetCodec()->Clone();
   fd_event_ = FdEventContainer::GetFdContainer()->GetFdEvent(fd);
   fd_event_->SetReactor(reactor_);
-  InitBuffer(buff_size);
-  loop_cor_ = GetCoroutinePool()->GetCoroutineInstanse();
+  buff_size_ = buff_size;
   state_ = Connected;
   LOG_DEBUG << "succ create tcp connection[" << state_ << "], fd=" << fd;
 }
@@ -52,6 +50,8 @@ TcpConnection::TcpConnection(TcpClient *client, Reactor *reactor, int fd, int bu
 }
 
 void TcpConnection::InitServer() {
+  // it's called in io thread, loop coroutine is taken from coroutine pool of this thread
+  loop_cor_ = GetConnectionCoroutinePool()->GetCoroutineInstanse();
   RegisterToTimeWheel();
   loop_cor_->SetCallBack(std::bind(&TcpConnection::MainServerLoopCorFunc, this));
 }
@@ -59,16 +59,18 @@ void TcpConnection::InitServer() {
 void TcpConnection::SetUpServer() { reactor_->AddCoroutine(loop_cor_); }
 
 void TcpConnection::RegisterToTimeWheel() {
-  auto cb = [](TcpConnection::ptr conn) { conn->ShutdownConnection(); };
-  TcpTimeWheel::TcpConnectionSlot::ptr tmp = std::make_shared<AbstractSlot<TcpConnection>>(shared_from_this(), cb);
-  weak_slot_ = tmp;
-  server_->FreshTcpConnection(tmp);
+  last_active_ms_.store(GetNowMs(), std::memory_order_relaxed);
+  // it's called in io thread by InitServer, the time wheel of this thread can be touched directly
+  server_->GetTimeWheel(io_thread_)->Add(shared_from_this());
 }
 
 void TcpConnection::SetUpClient() { SetState(Connected); }
 
 TcpConnection::~TcpConnection() {
-  if (connection_type_ == ServerConnection) {
+  if (connection_type_ == ServerConnection && loop_cor_ != nullptr) {
+    // loop coroutine yields for ever after peer closed and it's released after it yields,
+    // nobody resumes it again, so its stack can be reused though the function hasn't finished
+    loop_cor_->SetIsInCoFunc(false);
     GetCoroutinePool()->ReturnCoroutine(loop_cor_);
   }
 
@@ -82,6 +84,8 @@ void TcpConnection::InitBuffer(int size) {
 }
 
 void TcpConnection::MainServerLoopCorFunc() {
+  // it first runs in its io thread, buffers are first touched there and allocated on local numa node
+  InitBuffer(buff_size_);
   while (!stop_) {
     Input();
 
@@ -102,6 +106,9 @@ void TcpConnection::Input() {
     return;
   }
 
+  // decoded packages refer to consumed data of last input, they have been handled now
+  read_buffer_->AdjustBuffer();
+
   bool read_all = false;
   bool close_flag = false;
   int count = 0;
@@ -114,13 +121,13 @@ void TcpConnection::Input() {
     int read_count = read_buffer_->Writeable();
     int write_index = read_buffer_->WriteIndex();
 
-    LOG_DEBUG << "read_buffer_ size=" << read_buffer_->GetBufferVector().size() << "rd=" << read_buffer_->ReadIndex()
+    LOG_DEBUG << "read_buffer_ size=" << read_buffer_->GetSize() << "rd=" << read_buffer_->ReadIndex()
               << "wd=" << read_buffer_->WriteIndex();
     int rt = recv_hook(fd_, &(read_buffer_->buffer_[write_index]), read_count, 0);
     if (rt > 0) {
       read_buffer_->RecycleWrite(rt);
     }
-    LOG_DEBUG << "read_buffer_ size=" << read_buffer_->GetBufferVector().size() << "rd=" << read_buffer_->ReadIndex()
+    LOG_DEBUG << "read_buffer_ size=" << read_buffer_->GetSize() << "rd=" << read_buffer_->ReadIndex()
               << "wd=" << read_buffer_->WriteIndex();
 
     LOG_DEBUG << "read data back, fd=" << fd_;
@@ -129,6 +136,11 @@ void TcpConnection::Input() {
       LOG_INFO << "over timer, now break read function";
       break;
     }
+    if (rt < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      // coroutine is woken by a stale event, there is nothing to read now
+      read_all = true;
+      break;
+    }
     if (rt <= 0) {
       LOG_DEBUG << "rt <= 0";
       close_flag = true;
@@ -148,6 +160,10 @@ void TcpConnection::Input() {
   }
   if (close_flag) {
     ClearClient();
+    if (connection_type_ == ClientConnection) {
+      // TcpClient will check state and report peer closed, nobody would resume this coroutine
+      return;
+    }
     LOG_DEBUG << "peer close, now yield current coroutine, wait main thread clear this TcpConnection";
     // Coroutine::GetCurrentCoroutine()->SetCanResume(false);
     Coroutine::Yield();
@@ -162,10 +178,8 @@ void TcpConnection::Input() {
     LOG_ERROR << "not read all data in socket buffer";
   }
   if (connection_type_ == ServerConnection) {
-    TcpTimeWheel::TcpConnectionSlot::ptr tmp = weak_slot_.lock();
-    if (tmp) {
-      server_->FreshTcpConnection(tmp);
-    }
+    // time wheel checks it lazily when its bucket expires
+    last_active_ms_.store(GetNowMs(), std::memory_order_relaxed);
   }
 }
 
@@ -197,11 +211,11 @@ void TcpConnection::Execute() {
 }
 
 void TcpConnection::Output() {
-  if (is_over_time_) {
-    LOG_INFO << "over timer, skip output progress";
-    return;
-  }
   while (true) {
+    if (is_over_time_) {
+      LOG_INFO << "over timer, now break write function";
+      break;
+    }
     TcpConnectionState state = GetState();
     if (state != Connected) {
       break;
@@ -212,12 +226,18 @@ void TcpConnection::Output() {
       break;
     }
 
+    // TcpClient callers append requests while this coroutine waits, which may move the buffer,
+    // so the data to send is taken again after every wait instead of being held across it
     int total_size = write_buffer_->Readable();
     int read_index = write_buffer_->ReadIndex();
-    int rt = send_hook(fd_, &(write_buffer_->buffer_[read_index]), total_size, 0);
-    // LOG_INFO << "write end";
+    ssize_t rt = ::send(fd_, &(write_buffer_->buffer_[read_index]), total_size, MSG_DONTWAIT);
+    if (rt < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      wait_writable_hook(fd_);
+      continue;
+    }
     if (rt <= 0) {
       LOG_ERROR << "write empty, error=" << strerror(errno);
+      break;
     }
 
     LOG_DEBUG << "succ write " << rt << " bytes";
@@ -225,17 +245,6 @@ void TcpConnection::Output() {
     LOG_DEBUG << "recycle write index =" << write_buffer_->WriteIndex()
               << ", read_index =" << write_buffer_->ReadIndex() << "readable = " << write_buffer_->Readable();
     LOG_DEBUG << "send[" << rt << "] bytes data to [" << peer_addr_->ToString() << "], fd [" << fd_ << "]";
-    if (write_buffer_->Readable() <= 0) {
-      // LOG_INFO << "send all data, now unregister write event on reactor and yield Coroutine";
-      LOG_DEBUG << "send all data, now unregister write event and break";
-      // fd_event_->DelListenEvents(IOEvent::WRITE);
-      break;
-    }
-
-    if (is_over_time_) {
-      LOG_INFO << "over timer, now break write function";
-      break;
-    }
   }
 }
 
@@ -288,6 +297,11 @@ auto TcpConnection::GetResPackageData(const std::string &msg_req, TinyPbStruct::
   return false;
 }
 
+void TcpConnection::TakeResPackageData(std::map<std::string, TinyPbStruct::pb_ptr> &datas) {
+  datas.clear();
+  datas.swap(reply_datas_);
+}
+
 auto TcpConnection::GetCodec() const -> AbstractCodeC::ptr { return codec_; }
 
 auto TcpConnection::GetState() -> TcpConnectionState {
@@ -306,4 +320,6 @@ auto TcpConnection::GetOverTimerFlag() -> bool { return is_over_time_; }
 
 auto TcpConnection::GetCoroutine() -> Coroutine::ptr { return loop_cor_; }
 
+auto TcpConnection::GetReactor() -> Reactor * { return reactor_; }
+
 }  // namespace tirpc
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <atomic>
 #include <memory>
 #include <queue>
 #include <vector>
@@ -14,7 +15,6 @@
 #include "tirpc/net/rpc/rpc_codec.hpp"
 #include "tirpc/net/tcp/abstract_codec.hpp"
 #include "tirpc/net/tcp/abstract_data.hpp"
-#include "tirpc/net/tcp/abstract_slot.hpp"
 #include "tirpc/net/tcp/io_thread.hpp"
 #include "tirpc/net/tcp/tcp_buffer.hpp"
 #include "tirpc/net/tcp/tcp_connection_time_wheel.hpp"
@@ -69,10 +69,19 @@ class TcpConnection : public std::enable_shared_from_this<TcpConnection> {
 
   auto GetResPackageData(const std::string &msg_req, TinyPbStruct::pb_ptr &pb_struct) -> bool;
 
+  void TakeResPackageData(std::map<std::string, TinyPbStruct::pb_ptr> &datas);
+
   void RegisterToTimeWheel();
 
+  /**
+   * @brief 最后一次读到数据的时间，ms，时间轮据此判断连接是否空闲
+   */
+  auto GetLastActiveTime() const -> int64_t { return last_active_ms_.load(std::memory_order_relaxed); }
+
   auto GetCoroutine() -> Coroutine::ptr;
 
+  auto GetReactor() -> Reactor *;
+
  public:
   void MainServerLoopCorFunc();
 
@@ -103,6 +112,7 @@ class TcpConnection : public std::enable_shared_from_this<TcpConnection> {
 
   Address::ptr peer_addr_;
 
+  int buff_size_{0};
   TcpBuffer::ptr read_buffer_;
   TcpBuffer::ptr write_buffer_;
 
@@ -118,7 +128,8 @@ class TcpConnection : public std::enable_shared_from_this<TcpConnection> {
 
   std::map<std::string, std::shared_ptr<TinyPbStruct>> reply_datas_;
 
-  std::weak_ptr<AbstractSlot<TcpConnection>> weak_slot_;
+  // written by the thread running loop coroutine, read by time wheel of its io thread
+  std::atomic<int64_t> last_active_ms_{0};
 
   RWMutex mutex_;
 };
@@ -1,19 +1,17 @@
 #include "tirpc/net/tcp/tcp_connection_time_wheel.hpp"
 
-#include <queue>
+#include <algorithm>
+#include <utility>
 #include <vector>
 
 #include "tirpc/net/base/timer.hpp"
-#include "tirpc/net/tcp/abstract_slot.hpp"
+#include "tirpc/net/tcp/tcp_connection.hpp"
 
 namespace tirpc {
 
 TcpTimeWheel::TcpTimeWheel(Reactor *reactor, int bucket_count, int interval /*= 10*/)
-    : reactor_(reactor), bucket_count_(bucket_count), interval_(interval) {
-  for (int i = 0; i < bucket_count; ++i) {
-    std::vector<TcpConnectionSlot::ptr> tmp;
-    wheel_.push(tmp);
-  }
+    : reactor_(reactor), bucket_count_(std::max(bucket_count, 1)), interval_(interval) {
+  buckets_.resize(bucket_count_);
 
   event_ = std::make_shared<TimerEvent>(interval_ * 1000, true, std::bind(&TcpTimeWheel::LoopFunc, this));
   reactor_->GetTimer()->AddTimerEvent(event_);
@@ -21,17 +19,34 @@ TcpTimeWheel::TcpTimeWheel(Reactor *reactor, int bucket_count, int interval /*=
 
 TcpTimeWheel::~TcpTimeWheel() { reactor_->GetTimer()->DelTimerEvent(event_); }
 
-void TcpTimeWheel::LoopFunc() {
-  // LOG_DEBUG << "pop src bucket";
-  wheel_.pop();
-  std::vector<TcpConnectionSlot::ptr> tmp;
-  wheel_.push(tmp);
-  // LOG_DEBUG << "push new bucket";
+void TcpTimeWheel::Add(std::weak_ptr<TcpConnection> conn) {
+  // the bucket before cur_ expires last, after bucket_count_ intervals
+  buckets_[(cur_ + bucket_count_ - 1) % bucket_count_].emplace_back(std::move(conn));
 }
 
-void TcpTimeWheel::Fresh(TcpConnectionSlot::ptr slot) {
-  LOG_DEBUG << "fresh connection";
-  wheel_.back().emplace_back(slot);
+void TcpTimeWheel::LoopFunc() {
+  std::vector<std::weak_ptr<TcpConnection>> expired;
+  expired.swap(buckets_[cur_]);
+  cur_ = (cur_ + 1) % bucket_count_;
+
+  int64_t interval_ms = static_cast<int64_t>(interval_) * 1000;
+  int64_t timeout = bucket_count_ * interval_ms;
+  int64_t now = GetNowMs();
+  for (auto &weak : expired) {
+    TcpConnection::ptr conn = weak.lock();
+    if (!conn || conn->GetState() == Closed) {
+      continue;
+    }
+    int64_t idle = now - conn->GetLastActiveTime();
+    if (idle >= timeout) {
+      conn->ShutdownConnection();
+      continue;
+    }
+    // it read data after it was put in, move it to the bucket expires when the rest of timeout runs out
+    int64_t rest = timeout - idle;
+    int64_t n = std::clamp<int64_t>((rest + interval_ms - 1) / std::max<int64_t>(interval_ms, 1), 1, bucket_count_);
+    buckets_[(cur_ + n - 1) % bucket_count_].emplace_back(std::move(weak));
+  }
 }
 
-}  // namespace tirpc
\ No newline at end of file
+}  // namespace tirpc
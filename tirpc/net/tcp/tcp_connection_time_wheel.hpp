@@ -1,27 +1,32 @@
 #pragma once
 
-#include <queue>
+#include <memory>
 #include <vector>
 
 #include "tirpc/net/base/reactor.hpp"
 #include "tirpc/net/base/timer.hpp"
-#include "tirpc/net/tcp/abstract_slot.hpp"
 
 namespace tirpc {
 
 class TcpConnection;
 
+/**
+ * @brief 空闲连接时间轮，每个 IO 线程一个，只在该线程的 reactor 中访问
+ * 连接读到数据只更新自己的最后活跃时间，桶到期时才检查，空闲超过 bucket_count * interval 秒的连接被关闭，
+ * 其余的按剩余时间挂到对应的桶上
+ */
 class TcpTimeWheel {
  public:
   using ptr = std::shared_ptr<TcpTimeWheel>;
 
-  using TcpConnectionSlot = AbstractSlot<TcpConnection>;
-
   TcpTimeWheel(Reactor *reactor, int bucket_count, int invetal = 10);
 
   ~TcpTimeWheel();
 
-  void Fresh(TcpConnectionSlot::ptr slot);
+  /**
+   * @brief 把连接放入时间轮，只能在 reactor 的 loop 线程调用
+   */
+  void Add(std::weak_ptr<TcpConnection> conn);
 
   void LoopFunc();
 
@@ -31,7 +36,8 @@ class TcpTimeWheel {
   int interval_{0};  // second
 
   TimerEvent::ptr event_;
-  std::queue<std::vector<TcpConnectionSlot::ptr>> wheel_;
+  std::vector<std::vector<std::weak_ptr<TcpConnection>>> buckets_;
+  int cur_{0};  // bucket expires at next LoopFunc
 };
 
 }  // namespace tirpc
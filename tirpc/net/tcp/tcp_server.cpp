@@ -7,6 +7,7 @@
 #include <utility>
 
 #include "tirpc/common/config.hpp"
+#include "tirpc/common/util.hpp"
 #include "tirpc/coroutine/coroutine.hpp"
 #include "tirpc/coroutine/coroutine_pool.hpp"
 #include "tirpc/net/tcp/io_thread.hpp"
@@ -22,17 +23,40 @@ static ConfigVar<std::string>::ptr g_server_protocal = Config::Lookup("server.pr
 static ConfigVar<int>::ptr g_iothread_num = Config::Lookup("iothread_num", 1, "IO thread number");
 static ConfigVar<int>::ptr g_timewheel_bucket_num = Config::Lookup("time_wheel.bucket_num", 3, "TimeWheel bucket num");
 static ConfigVar<int>::ptr g_timewheel_interval = Config::Lookup("time_wheel.interval", 5, "TimeWheel interval");
+static ConfigVar<int>::ptr g_so_busy_poll = Config::Lookup(
+    "server.so_busy_poll_us", 0, "SO_BUSY_POLL of accepted socket, us. 0 means not set, it may need CAP_NET_ADMIN");
+static ConfigVar<int>::ptr g_main_reactor_cpu = Config::Lookup(
+    "cpu_affinity.main_reactor", -1, "cpu main reactor thread bound to, -1 means not bound");
+static ConfigVar<bool>::ptr g_reuse_port = Config::Lookup(
+    "server.reuse_port", false, "every io thread listens on its own SO_REUSEPORT socket and accepts connections itself");
+
+static void BindMainReactorCpu() {
+  // after io threads are created, otherwise they inherit this affinity
+  int cpu = g_main_reactor_cpu->GetValue();
+  if (cpu >= 0 && ThreadUtil::BindCpu(cpu)) {
+    LOG_INFO << "main reactor is bound to cpu [" << cpu << "]";
+  }
+}
+
+void TcpServer::CreateTimeWheels() {
+  // timer of each wheel runs in its io thread, main reactor does nothing for idle connections
+  for (int i = 0; i < io_pool_->GetIoThreadPoolSize(); ++i) {
+    time_wheels_.push_back(std::make_shared<TcpTimeWheel>(io_pool_->GetIoThreadByIndex(i)->GetReactor(),
+                                                          g_timewheel_bucket_num->GetValue(),
+                                                          g_timewheel_interval->GetValue()));
+  }
+}
 
 TcpServer::TcpServer() {
   addr_ = std::make_shared<IPAddress>(g_server_ip->GetValue(), g_server_port->GetValue());
 
   io_pool_ = std::make_shared<IOThreadPool>(g_iothread_num->GetValue());
+  BindMainReactorCpu();
 
   main_reactor_ = Reactor::GetReactor();
   main_reactor_->SetReactorType(MainReactor);
 
-  time_wheel_ = std::make_shared<TcpTimeWheel>(main_reactor_, g_timewheel_bucket_num->GetValue(),
-                                               g_timewheel_interval->GetValue());
+  CreateTimeWheels();
 
   clear_clent_timer_event_ =
       std::make_shared<TimerEvent>(10000, true, std::bind(&TcpServer::ClearClientTimerFunc, this));
@@ -43,12 +67,12 @@ TcpServer::TcpServer() {
 
 TcpServer::TcpServer(Address::ptr addr) : addr_(std::move(addr)) {
   io_pool_ = std::make_shared<IOThreadPool>(g_iothread_num->GetValue());
+  BindMainReactorCpu();
 
   main_reactor_ = Reactor::GetReactor();
   main_reactor_->SetReactorType(MainReactor);
 
-  time_wheel_ = std::make_shared<TcpTimeWheel>(main_reactor_, g_timewheel_bucket_num->GetValue(),
-                                               g_timewheel_interval->GetValue());
+  CreateTimeWheels();
 
   clear_clent_timer_event_ =
       std::make_shared<TimerEvent>(10000, true, std::bind(&TcpServer::ClearClientTimerFunc, this));
@@ -61,16 +85,40 @@ void TcpServer::Start() {
   if (!start_info_.empty()) {
     std::cout << start_info_ << std::endl << std::endl;
   }
-  acceptor_ = Socket::CreateTCP(addr_);
-  acceptor_->Bind(addr_);
-  acceptor_->Listen();
-  accept_cor_ = GetCoroutinePool()->GetCoroutineInstanse();
-  accept_cor_->SetCallBack(std::bind(&TcpServer::MainAcceptCorFunc, this));
-
-  LOG_DEBUG << "resume accept coroutine";
-  Coroutine::Resume(accept_cor_.get());
-
-  // accept_cor 已经执行，但在服务器刚启动时没有其它连接（NonBlocking），所以 Yield 回来了
+  reuse_port_ = g_reuse_port->GetValue();
+  if (reuse_port_) {
+    // kernel spreads connections among listen sockets by hash of 4-tuple, no handoff between threads
+    int size = io_pool_->GetIoThreadPoolSize();
+    io_clients_.resize(size);
+    io_clear_client_timer_events_.resize(size);
+    for (int i = 0; i < size; ++i) {
+      Socket::ptr acceptor = Socket::CreateTCP(addr_);
+      if (!acceptor->SetReusePort()) {
+        LOG_ERROR << "set SO_REUSEPORT error, sys errinfo = " << strerror(errno);
+        Exit(0);
+      }
+      if (!acceptor->Bind(addr_)) {
+        LOG_ERROR << "bind [" << addr_->ToString() << "] error, sys errinfo = " << strerror(errno);
+        Exit(0);
+      }
+      acceptor->Listen();
+      io_acceptors_.push_back(acceptor);
+      io_accept_cors_.push_back(
+          io_pool_->AddCoroutineToThreadByIndex(i, std::bind(&TcpServer::IoAcceptCorFunc, this, acceptor)));
+    }
+    acceptor_ = io_acceptors_.front();
+  } else {
+    acceptor_ = Socket::CreateTCP(addr_);
+    acceptor_->Bind(addr_);
+    acceptor_->Listen();
+    accept_cor_ = GetCoroutinePool()->GetCoroutineInstanse();
+    accept_cor_->SetCallBack(std::bind(&TcpServer::MainAcceptCorFunc, this));
+
+    LOG_DEBUG << "resume accept coroutine";
+    Coroutine::Resume(accept_cor_.get());
+
+    // accept_cor 已经执行，但在服务器刚启动时没有其它连接（NonBlocking），所以 Yield 回来了
+  }
 
   io_pool_->Start();
   main_reactor_->Loop();
@@ -78,6 +126,9 @@ void TcpServer::Start() {
 
 TcpServer::~TcpServer() {
   GetCoroutinePool()->ReturnCoroutine(accept_cor_);
+  for (auto &cor : io_accept_cors_) {
+    GetCoroutinePool()->ReturnCoroutine(cor);
+  }
   if (register_) {
     register_->Clear();
   }
@@ -91,22 +142,83 @@ void TcpServer::MainAcceptCorFunc() {
       Coroutine::Yield();
       continue;
     }
-    IOThread *io_thread = io_pool_->GetIoThread();
-    TcpConnection::ptr conn = AddClient(io_thread, sock->GetFd());
-    conn->InitServer();
-    LOG_DEBUG << "tcpconnection address is " << conn.get() << ", and fd is" << sock->GetFd();
+    SetUpConnection(sock, io_pool_->GetIoThread());
+  }
+}
+
+void TcpServer::IoAcceptCorFunc(Socket::ptr acceptor) {
+  // timer runs in this io thread, so it's the only one touches its clients
+  int index = IOThread::GetCurrentIOThread()->GetThreadIndex();
+  io_clear_client_timer_events_[index] = std::make_shared<TimerEvent>(
+      10000, true, [this, index]() { ClearClients(io_clients_[index]); });
+  Reactor::GetReactor()->GetTimer()->AddTimerEvent(io_clear_client_timer_events_[index]);
+
+  while (!is_stop_accept_) {
+    // accept_hook waits in this io thread until a connection comes
+    Socket::ptr sock = acceptor->Accept();
+    if (sock == nullptr) {
+      continue;
+    }
+    SetUpConnection(sock, IOThread::GetCurrentIOThread());
+  }
+}
 
-    io_thread->GetReactor()->AddCoroutine(conn->GetCoroutine());
-    tcp_counts_++;
-    LOG_DEBUG << "current tcp connection count is [" << tcp_counts_ << "]";
+void TcpServer::SetUpConnection(const Socket::ptr &sock, IOThread *io_thread) {
+  if (g_so_busy_poll->GetValue() > 0) {
+    // let recv spin on the device queue, it works with reactor.busy_poll_us
+    if (!sock->SetOption(SOL_SOCKET, SO_BUSY_POLL, g_so_busy_poll->GetValue())) {
+      LOG_WARN << "set SO_BUSY_POLL of fd[" << sock->GetFd() << "] error, sys errinfo = " << strerror(errno);
+    }
   }
+  TcpConnection::ptr conn = AddClient(io_thread, sock->GetFd());
+  LOG_DEBUG << "tcpconnection address is " << conn.get() << ", and fd is" << sock->GetFd();
+
+  // connection takes its coroutine from the pool of io_thread, so it's set up there.
+  // in reuse_port mode it's called in io_thread, the coroutine is queued in its loop without wakeup
+  if (IOThread::GetCurrentIOThread() == io_thread) {
+    conn->InitServer();
+    conn->SetUpServer();
+  } else {
+    io_thread->GetReactor()->AddTask([conn]() {
+      conn->InitServer();
+      conn->SetUpServer();
+    });
+  }
+  int count = tcp_counts_.fetch_add(1, std::memory_order_relaxed) + 1;
+  LOG_DEBUG << "current tcp connection count is [" << count << "]";
 }
 
 void TcpServer::AddCoroutine(Coroutine::ptr cor) { main_reactor_->AddCoroutine(cor); }
 
+auto TcpServer::GetClients(IOThread *io_thread) -> std::unordered_map<int, std::shared_ptr<TcpConnection>> & {
+  if (reuse_port_) {
+    return io_clients_[io_thread->GetThreadIndex()];
+  }
+  return clients_;
+}
+
+void TcpServer::ReleaseConnection(TcpConnection::ptr conn) {
+  // release it in its io thread. the coroutine may be stolen and still running in another io thread,
+  // so wait until it yields, otherwise it would run on a freed stack
+  Reactor *reactor = conn->GetReactor();
+  reactor->AddTask([conn]() mutable {
+    Coroutine::ptr cor = conn->GetCoroutine();
+    if (cor != nullptr && cor->IsRunning()) {
+      ReleaseConnection(std::move(conn));
+      return;
+    }
+    conn.reset();
+  });
+}
+
 auto TcpServer::AddClient(IOThread *io_thread, int fd) -> TcpConnection::ptr {
-  auto it = clients_.find(fd);
-  if (it != clients_.end()) {
+  auto &clients = GetClients(io_thread);
+  auto it = clients.find(fd);
+  if (it != clients.end()) {
+    if (it->second) {
+      // fd is reused as soon as old connection close it, but old connection's coroutine may not yield yet.
+      ReleaseConnection(it->second);
+    }
     it->second.reset();
     // set new Tcpconnection
     LOG_DEBUG << "fd " << fd << "have exist, reset it";
@@ -115,28 +227,23 @@ auto TcpServer::AddClient(IOThread *io_thread, int fd) -> TcpConnection::ptr {
   }
   LOG_DEBUG << "fd " << fd << "did't exist, new it";
   TcpConnection::ptr conn = std::make_shared<TcpConnection>(this, io_thread, fd, 128, GetPeerAddr());
-  clients_.insert(std::make_pair(fd, conn));
+  clients.insert(std::make_pair(fd, conn));
   return conn;
 }
 
-void TcpServer::FreshTcpConnection(TcpTimeWheel::TcpConnectionSlot::ptr slot) {
-  auto cb = [slot, this]() mutable {
-    this->GetTimeWheel()->Fresh(slot);
-    slot.reset();
-  };
-  main_reactor_->AddTask(cb);
-}
+void TcpServer::ClearClientTimerFunc() { ClearClients(clients_); }
 
-void TcpServer::ClearClientTimerFunc() {
+void TcpServer::ClearClients(std::unordered_map<int, std::shared_ptr<TcpConnection>> &clients) {
   // LOG_DEBUG << "this IOThread loop timer excute";
 
   // delete Closed TcpConnection per loop
   // for free memory
   // LOG_DEBUG << "clients_.size=" << clients_.size();
-  for (auto &i : clients_) {
+  for (auto &i : clients) {
     // TcpConnection::ptr s_conn = i.second;
     // LOG_DEBUG << "state = " << s_conn->GetState();
-    if (i.second && i.second.use_count() > 0 && i.second->GetState() == Closed) {
+    if (i.second && i.second.use_count() > 0 && i.second->GetState() == Closed &&
+        i.second->GetCoroutine() != nullptr && !i.second->GetCoroutine()->IsRunning()) {
       // need to delete TcpConnection
       LOG_DEBUG << "TcpConection [fd:" << i.first << "] will delete, state=" << i.second->GetState();
       (i.second).reset();
@@ -149,7 +256,9 @@ auto TcpServer::GetPeerAddr() -> Address::ptr { return acceptor_->GetRemoteAddr(
 
 auto TcpServer::GetLocalAddr() -> Address::ptr { return addr_; }
 
-auto TcpServer::GetTimeWheel() -> TcpTimeWheel::ptr { return time_wheel_; }
+auto TcpServer::GetTimeWheel(IOThread *io_thread) -> TcpTimeWheel::ptr {
+  return time_wheels_[io_thread->GetThreadIndex()];
+}
 
 auto TcpServer::GetIoThreadPool() -> IOThreadPool::ptr { return io_pool_; }
 
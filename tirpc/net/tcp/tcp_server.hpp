@@ -1,7 +1,9 @@
 #pragma once
 
 #include <google/protobuf/service.h>
+#include <atomic>
 #include <unordered_map>
+#include <vector>
 
 #include "tirpc/net/base/address.hpp"
 #include "tirpc/net/base/fd_event.hpp"
@@ -33,8 +35,6 @@ class TcpServer {
 
   auto AddClient(IOThread *io_thread, int fd) -> TcpConnection::ptr;
 
-  void FreshTcpConnection(TcpTimeWheel::TcpConnectionSlot::ptr slot);
-
  public:
   auto GetDispatcher() -> AbstractDispatcher::ptr;
 
@@ -46,13 +46,42 @@ class TcpServer {
 
   auto GetIoThreadPool() -> IOThreadPool::ptr;
 
-  auto GetTimeWheel() -> TcpTimeWheel::ptr;
+  /**
+   * @brief io_thread 的空闲连接时间轮，只能在 io_thread 中访问
+   */
+  auto GetTimeWheel(IOThread *io_thread) -> TcpTimeWheel::ptr;
 
  private:
+  void CreateTimeWheels();
+
   void MainAcceptCorFunc();
 
+  /**
+   * @brief reuse_port 模式下 IO 线程的 accept 协程，在本线程 accept 并处理连接，不经过主线程
+   *
+   * @param acceptor 这个 IO 线程独占的 SO_REUSEPORT 监听 socket
+   */
+  void IoAcceptCorFunc(Socket::ptr acceptor);
+
+  /**
+   * @brief 为 accept 到的连接创建 TcpConnection，并把它的协程交给 io_thread
+   */
+  void SetUpConnection(const Socket::ptr &sock, IOThread *io_thread);
+
+  /**
+   * @brief 获取 io_thread 上的连接所在的表，reuse_port 模式下每个 IO 线程一个，只由该线程访问
+   */
+  auto GetClients(IOThread *io_thread) -> std::unordered_map<int, std::shared_ptr<TcpConnection>> &;
+
+  /**
+   * @brief 在连接所属的 IO 线程中释放连接，等它的协程让出后才真正析构
+   */
+  static void ReleaseConnection(TcpConnection::ptr conn);
+
   void ClearClientTimerFunc();
 
+  void ClearClients(std::unordered_map<int, std::shared_ptr<TcpConnection>> &clients);
+
  protected:
   AbstractDispatcher::ptr dispatcher_;
 
@@ -67,7 +96,19 @@ class TcpServer {
  private:
   Socket::ptr acceptor_;
 
-  int tcp_counts_{0};
+  std::atomic<int> tcp_counts_{0};
+
+  // every io thread listens on its own SO_REUSEPORT socket and accepts locally, read from server.reuse_port
+  bool reuse_port_{false};
+
+  std::vector<Socket::ptr> io_acceptors_;
+
+  std::vector<Coroutine::ptr> io_accept_cors_;
+
+  // indexed by io thread index, only used when reuse_port_ is on
+  std::vector<std::unordered_map<int, std::shared_ptr<TcpConnection>>> io_clients_;
+
+  std::vector<TimerEvent::ptr> io_clear_client_timer_events_;
 
   Reactor *main_reactor_{nullptr};
 
@@ -78,10 +119,10 @@ class TcpServer {
   IOThreadPool::ptr io_pool_;
 
   /**
-   * @brief TCP 时间轮，用于管理 TcpConnection 的生存时间
+   * @brief TCP 时间轮，用于管理 TcpConnection 的生存时间，按 io 线程下标索引，每个 io 线程管理自己的连接
    *
    */
-  TcpTimeWheel::ptr time_wheel_;
+  std::vector<TcpTimeWheel::ptr> time_wheels_;
 
   std::unordered_map<int, std::shared_ptr<TcpConnection>> clients_;
 
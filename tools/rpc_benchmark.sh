@@ -2,7 +2,7 @@
 
 # 配置区（根据实际情况修改）
 TEST_ROUNDS=30    # 总测试轮次
-SERVER_PORT=19999 # 服务器端口
+SERVER_PORT=39999 # 服务器端口, 与 conf/rpc_server.yml 一致
 SERVER_CMD="./rpc_server"
 CLIENT_CMD="./rpc_client"
 OUTPUT_FILE="rpc_bench_results.csv"